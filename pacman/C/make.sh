@@ -4,27 +4,42 @@
 # of data types.
 case $(uname -s) in
 SunOS) # Verified under OpenSolaris 09/06--gcc 3.4.3
-  cc -m32 -march=i386 -DVT420 -Wall -lcurses -o pm420 pacman.c
+  cc -m32 -march=i386 -DVT420 -Wall -lcurses -o pm420 pacman.c pmrec.c pmcore.c
   test $? = 0 || {
     echo "$0: VT420 build failed"
     exit 1
   }
 
-  cc -m32 -march=i386 -DVT340 -Wall -lcurses -o pm340 pacman.c
+  cc -m32 -march=i386 -DVT340 -Wall -lcurses -o pm340 pacman.c pmrec.c pmcore.c
   test $? = 0 || {
     echo "$0: VT340 build failed"
     exit 1
   }
+
+  cc -m32 -march=i386 -Wall -o pmsim pmsim.c pmlock.c pmrec.c pmcore.c
+  test $? = 0 || {
+    echo "$0: headless build failed"
+    exit 1
+  }
   ;;
 
 Linux) # Linux, gcc >= 7.5.0
-  CFLAGS="-DFORCE_CURSES"
+  CFLAGS="-DFORCE_CURSES -DOB_THREAD"
 # AFLAGS="-m32 -march=i686"    # Please uncomment for 32 bit support
-  LDFLAGS="-lncurses -ltinfo"
+  LDFLAGS="-lncurses -ltinfo -lpthread"
+  OFLAGS="-O3"                 # Game rules and headless runs only
+
+  # The game rules and input logs, shared by all targets
+  cc ${AFLAGS} ${OFLAGS} -c -Wpedantic -o pmcore.o pmcore.c && \
+  cc ${AFLAGS} -c -Wpedantic -o pmrec.o pmrec.c
+  test $? = 0 || {
+    echo "$0: game core build failed"
+    exit 1
+  }
 
   # Targetting the VT420
   cc ${AFLAGS} ${CFLAGS} -DVT420 -c -Wpedantic -o pm420.o pacman.c && \
-  cc ${AFLAGS} -o pm420 pm420.o ${LDFLAGS}
+  cc ${AFLAGS} -o pm420 pm420.o pmrec.o pmcore.o ${LDFLAGS}
   test $? = 0 || {
     echo "$0: VT420 build failed"
     exit 1
@@ -32,11 +47,20 @@ Linux) # Linux, gcc >= 7.5.0
 
   # Targetting the VT340
   cc ${AFLAGS} ${CFLAGS} -DVT340 -c -Wpedantic -o pm340.o pacman.c && \
-  cc ${AFLAGS} -o pm340 pm340.o ${LDFLAGS}
+  cc ${AFLAGS} -o pm340 pm340.o pmrec.o pmcore.o ${LDFLAGS}
   test $? = 0 || {
     echo "$0: VT340 build failed"
     exit 1
   }
+
+  # Headless, no terminal needed
+  cc ${AFLAGS} ${OFLAGS} -c -Wpedantic -o pmlock.o pmlock.c && \
+  cc ${AFLAGS} ${OFLAGS} -DSIM_THREAD -c -Wpedantic -o pmsim.o pmsim.c && \
+  cc ${AFLAGS} -o pmsim pmsim.o pmlock.o pmrec.o pmcore.o -lpthread
+  test $? = 0 || {
+    echo "$0: headless build failed"
+    exit 1
+  }
   ;;
 *)
   echo "`basename $0`: unsupported operating system"
@@ -9,19 +9,32 @@
 
 #include <stdint.h>
 #include <termios.h>
-#include <unistd.h>     // Needed for read(2)
+#include <unistd.h>     // Needed for read(2)/write(2)
+#include <errno.h>
 #include <time.h>
 #include <poll.h>       // Under VMS, poll() is to be used for non-sockets
+#ifndef __VMS
+#include <sys/ioctl.h>  // TIOCOUTQ
+#endif
 
 #ifdef FORCE_CURSES
 #include <curses.h>     // In the absence of tcgetattr()/tcsetattr()...
 #endif
 
+#ifdef OB_THREAD        // Asynchronous output support (-a)
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 
+#include "pmcore.h"
+#include "pmrec.h"
+
 // Pacman for the DEC VT420/340. Francois Laagel. Jan-Jun 2024.
 //
 // "Whereof one cannot speak, thereof one must be silent."
@@ -31,13 +44,7 @@
 // More of these might have been introduced in the process.
 // So it goes (KV)...
 
-#define CLKPERIOD 170  // Expressed in milliseconds
-#define NGHOST 4
 #define SILENT 0
-#define NENTITY (1+NGHOST)
-
-// A clock cycle count during which PM stays "supercharged."
-#define SUPER_CLKCYCLES 121
 
 /*
  * Early design decisions:
@@ -46,88 +53,424 @@
  * - DOUBLEs are mapped to int32_t.
  */
 
-uint16_t seed;         // Must be NZ on first use!
-uint32_t hiscore;
-uint32_t score;
-uint32_t lives;
-uint32_t gamlev;
-uint32_t bonus;
-uint32_t suptim;
-uint32_t serialno = 0; // Instance number generator.
-uint32_t nremitem = 0;
+// The game rules live in pmcore.c. This is the terminal front end.
+game_t game;
 
 // Disable BELL if TRUE
 uint32_t silent = 0;
 
-// The entity vector.
-void *entvec[NENTITY];
-#define PACMAN_ADDR ((entity *)(entvec[0]))
+// Print output statistics on exit if TRUE (-s)
+uint32_t opt_stats = 0;
+
+// Always upload the soft font if TRUE (-f)
+uint32_t opt_reload = 0;
+
+// Asynchronous terminal output if TRUE (-a)
+uint32_t opt_async = 0;
+
+// Skip frames while the line is busy if TRUE (-c)
+uint32_t opt_coalesce = 0;
+
+// Drop missed clock cycles instead of catching up if TRUE (-d)
+uint32_t opt_tickdrop = 0;
+
+// Measure the terminal lag every that many clock cycles (-l)
+uint32_t opt_dsr = 0;
+
+// Wire accounting options.
+uint32_t opt_baud = 9600;        // Line speed (-r)
+uint32_t opt_overlay = 0;        // Show the counters if TRUE (-w)
+char *opt_csv = NULL;            // CSV time series file (-o)
+char *opt_inlog = NULL;          // Input log to record (-i)
+char *opt_replay = NULL;         // Input log to play back (-p)
+uint32_t opt_kfint = 500;        // Clock cycles between keyframes (-k)
+
+// Ghost AI (-e). The distance table of ai_maze is built once.
+ghostai_t opt_ai = ai_euclid;
+mazedist_t mazedist;
 
 // Forward references...
-uint32_t fright_timer;
 void finalize(void);
-void super_enter(void);
-void super_leave(void);
-void *entity_new(uint8_t hcvr, uint8_t hcpc, uint8_t vrow, uint8_t pcol,
-  uint8_t cdir);
+void wire_mark(void);
+void keyboard_input_process(void);
+void screen_lost(void);
+void wire_account(void);
+void wire_dump(void);
+void inlog_close(void);
+
+// ------------------------------------------------------------
+// Shadow screen. The maze area is NROW lines by NPCOL physical
+// columns, each grid character being double width.
+#define NPCOL (2 * NCOL)
+uint8_t scr_tgt[NROW][NPCOL]; // What the terminal should display
+uint8_t scr_cur[NROW][NPCOL]; // What it does display. 0 if unknown
+
+// -------------------------------------------------------------
+// Terminal output. Everything emitted during a clock cycle is
+// assembled in 'obuf' and handed over to the OS with a single
+// write(2) by ob_flush(), right before we go to sleep. stdio is
+// not involved at all.
+
+#define OBUFSIZE 8192   // Hard capacity. A full redraw is ~2 KB
+
+uint8_t obuf[OBUFSIZE];
+uint32_t oblen = 0;     // # bytes pending in obuf
+
+// Output statistics.
+uint32_t ob_nqueued = 0;   // # bytes queued
+uint32_t ob_nglyph = 0;    // # of which were displayable characters
+uint32_t ob_nbyte = 0;     // # bytes written
+uint32_t ob_nflush = 0;    // # non empty flushes
+uint32_t ob_nsyscall = 0;  // # write(2) calls
+uint32_t ob_noverflow = 0; // # premature flushes (obuf was full)
+uint32_t ob_hiwat = 0;     // obuf high water mark
+
+// Write 'len' bytes to the terminal. Returns the number of
+// write(2) calls it took.
+uint32_t
+ob_send(const uint8_t *p, uint32_t len) {
+  uint32_t nsyscall = 0;
+  ssize_t n;
+
+  while (len) {
+    n = write(STDOUT_FILENO, p, len);
+    nsyscall++;
+    if (n == -1) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      break;                             // Nowhere to report this to...
+    }
+    p += n;
+    len -= n;
+  }
+  return nsyscall;
+}
 
-// Ghost mode enumeration.
-typedef enum ghostmode_t {
-  mode_scatter,
-  mode_chase,
-  mode_fright,
-  mode_unspec
-} ghostmode_t;
+#ifdef OB_THREAD
+// -------------------------------------------------------------
+// Asynchronous output (-a). ob_flush() copies obuf to a single
+// producer, single consumer ring and a dedicated thread writes
+// it to the terminal. The game never blocks on a slow line or on
+// XOFF, except at the few places where ob_sync() is called.
 
-// Those are global variables (in disguise).
-uint32_t gm_cur = mode_scatter;  // Current mode
-uint32_t gm_prv = mode_unspec;   // Previous mode
+#define RINGSIZE 65536  // Must be a power of two
 
-int32_t gm_timer_en = -1;
+uint8_t ring[RINGSIZE];
+atomic_uint ring_head;           // Producer index (free running)
+atomic_uint ring_tail;           // Consumer index (free running)
+atomic_uint ring_nsyscall;       // # write(2) calls by the consumer
+sem_t ring_sem;                  // Posted for every ring_push()
+uint32_t ring_on = 0;
 
-// ------------------------------------------------------------
-// Grid specification.
+// Ring statistics.
+uint32_t ring_hiwat = 0;         // High water mark
+uint32_t ring_nwait = 0;         // # times the producer had to wait
+uint32_t ring_ndrop = 0;         // # frames dropped
 
-#define NCOL 33
-#define NROW 23
-#define GRIDSIZE (NCOL * NROW)
-uint8_t grid[GRIDSIZE];
-#define NITEM 172     // The total number of collectible items
+// What to do with a frame that does not fit in the ring.
+typedef enum ring_policy_t {
+  ring_wait,                     // Wait for the consumer
+  ring_drop                      // Drop the frame, repaint later
+} ring_policy_t;
 
-// ------------------------------------------------------------
-// Well known symbols.
-#define door   ((uint8_t)'T')
-#define cross  ((uint8_t)'K')
-#define pellet ((uint8_t)'L')
+ring_policy_t
+ring_full_default(uint32_t need, uint32_t room) {
+  (void)need; (void)room;
+  return ring_drop;              // The simulation goes on
+}
 
-// ------------------------------------------------------------
-// Pseudo-random number generator.
+ring_policy_t (*ring_full_hook)(uint32_t need, uint32_t room) =
+  ring_full_default;
+
+void *
+ring_consumer(void *arg) {
+  uint32_t head, tail, len;
+
+  (void)arg;
+  for (;;) {
+    while (sem_wait(&ring_sem) == -1)
+      ;                          // EINTR
+
+    head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    while (tail != head) {
+      // Up to the end of the ring, then wrap.
+      len = head - tail;
+      if (len > RINGSIZE - (tail & (RINGSIZE - 1)))
+        len = RINGSIZE - (tail & (RINGSIZE - 1));
+      atomic_fetch_add(&ring_nsyscall,
+        ob_send(ring + (tail & (RINGSIZE - 1)), len));
+      tail += len;
+      atomic_store_explicit(&ring_tail, tail, memory_order_release);
+    }
+  }
+  return NULL;
+}
+
+void
+ring_start(void) {
+  pthread_t tid;
+
+  if (sem_init(&ring_sem, 0, 0) == -1 ||
+    pthread_create(&tid, NULL, ring_consumer, NULL))
+    return;                      // Synchronous output then
+  (void)pthread_detach(tid);
+  ring_on = 1;
+}
+
+// Returns 0 if the bytes were dropped.
+uint32_t
+ring_push(const uint8_t *p, uint32_t len, uint32_t droppable) {
+  uint32_t head, tail, room, n;
+  struct timespec rqt = { 0, 1000 * 1000 };
+  uint32_t waited = 0;
+
+  head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+  for (;;) {
+    tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+    if (len <= (room = RINGSIZE - (head - tail)))
+      break;
+
+    if (droppable && ring_full_hook(len, room) == ring_drop) {
+      ring_ndrop++;
+      screen_lost();
+      return 0;
+    }
+    if (!waited++)
+      ring_nwait++;
+    (void)nanosleep(&rqt, NULL);
+  }
+
+  n = RINGSIZE - (head & (RINGSIZE - 1));
+  if (n > len)
+    n = len;
+  memcpy(ring + (head & (RINGSIZE - 1)), p, n);
+  memcpy(ring, p + n, len - n);
+  atomic_store_explicit(&ring_head, head + len, memory_order_release);
+  (void)sem_post(&ring_sem);
+
+  if (head + len - tail > ring_hiwat)
+    ring_hiwat = head + len - tail;
+  return 1;
+}
+
+// Wait until the consumer has written everything.
+void
+ring_drain(void) {
+  struct timespec rqt = { 0, 1000 * 1000 };
+
+  while (atomic_load_explicit(&ring_tail, memory_order_acquire) !=
+    atomic_load_explicit(&ring_head, memory_order_relaxed))
+    (void)nanosleep(&rqt, NULL);
+}
+#endif                                   // OB_THREAD
+
+// Hand obuf over to the OS. Only a complete frame may be dropped
+// (asynchronous output, ring full).
+void
+ob_commit(uint32_t droppable) {
+  if (!oblen)
+    return;
+
+  if (oblen > ob_hiwat)
+    ob_hiwat = oblen;
+  ob_nflush++;
+
+#ifdef OB_THREAD
+  if (ring_on) {
+    if (ring_push(obuf, oblen, droppable))
+      ob_nbyte += oblen;
+    oblen = 0;
+    return;
+  }
+#else
+  (void)droppable;
+#endif
+
+  ob_nbyte += oblen;
+  ob_nsyscall += ob_send(obuf, oblen);
+  oblen = 0;
+}
 
-// Using John Metcalf's Xorshift LFSRs PRNG.
-// http://www.retroprogramming.com/2017/07/
-//   xorshift-pseudorandom-numbers-in-z80.html
-uint16_t
-prandom(void) {
-  seed ^= seed << 7;
-  seed ^= seed >> 9;
-  seed ^= seed << 8;
-  return seed;
+void
+ob_flush(void) {
+  ob_commit(0);
+}
+
+// Flush and make sure everything has reached the terminal driver.
+// Needed before anybody else (curses, stdio) writes to it.
+void
+ob_sync(void) {
+  ob_flush();
+#ifdef OB_THREAD
+  if (ring_on)
+    ring_drain();
+#endif
+}
+
+// # bytes still on their way to the terminal: in the tty driver
+// output queue and, with -a, in the ring. Only the former is
+// seen through TIOCOUTQ, where it is supported.
+uint32_t
+ob_pending(void) {
+  uint32_t n = 0;
+#ifdef TIOCOUTQ
+  int outq;
+
+  if (ioctl(STDOUT_FILENO, TIOCOUTQ, &outq) == 0 && outq > 0)
+    n = outq;
+#endif
+#ifdef OB_THREAD
+  if (ring_on)
+    n += atomic_load(&ring_head) - atomic_load(&ring_tail);
+#endif
+  return n;
+}
+
+// # write(2) calls so far, whoever made them.
+uint32_t
+ob_syscalls(void) {
+#ifdef OB_THREAD
+  return ob_nsyscall + atomic_load(&ring_nsyscall);
+#else
+  return ob_nsyscall;
+#endif
+}
+
+// Should obuf fill up, it is flushed early. This is accounted
+// for as an overflow. A frame should never do that.
+void
+ob_write(const void *buf, uint32_t len) {
+  const uint8_t *p = (const uint8_t *)buf;
+  uint32_t room;
+
+  ob_nqueued += len;
+  while (len > (room = OBUFSIZE - oblen)) {
+    memcpy(obuf + oblen, p, room);
+    oblen += room;
+    p += room;
+    len -= room;
+    ob_noverflow++;
+    ob_flush();
+  }
+
+  memcpy(obuf + oblen, p, len);
+  oblen += len;
+}
+
+void
+ob_putc(uint8_t c) {
+  ob_write(&c, 1);
+}
+
+void
+ob_puts(const char *s) {
+  ob_write(s, strlen(s));
+}
+
+// The terminal cursor position is tracked, so that at_xy() can
+// pick the cheapest way of getting anywhere. Control sequences
+// are emitted with ob_putc()/ob_puts()/ob_write() and are not
+// supposed to move the cursor. Displayable characters are
+// emitted with ob_text()/ob_texts() and move it to the right.
+#define SCRWIDTH 80
+#define SCRHEIGHT 24
+
+int32_t cur_x = -1;        // Cursor column. -1 if unknown
+int32_t cur_y = -1;        // Cursor line. -1 if unknown
+
+void
+cursor_lost(void) {
+  cur_x = cur_y = -1;
 }
 
 // -------------------------------------------------------------
-// Select Graphic Rendition (SGR). VT100 control sequences.
-// This is particularly necessary on the VT340.
+// Rendition state. Emitters state what they need with
+// default_charset_select()/custom_charset_select() and
+// bold_sgr()/default_sgr(). Nothing is sent right away: the
+// locking shift and SGR sequences are emitted by term_sync(),
+// before the next displayable character, and only if the
+// terminal is not already in the required state.
+#define TS_UNKNOWN 0xFF
+
+uint8_t gl_want = 0;             // GL: 0 for G0, 1 for G1
+uint8_t gl_cur = TS_UNKNOWN;
+uint8_t sgr_want = 0;            // SGR parameter: 0 or 1 (bold)
+uint8_t sgr_cur = TS_UNKNOWN;
+
+// Rendition statistics.
+uint32_t ts_nreq = 0;            // # state requests
+uint32_t ts_nsent = 0;           // # shifts/SGRs actually sent
+
+// The terminal state is no longer known (curses got involved).
+void
+term_lost(void) {
+  gl_cur = sgr_cur = TS_UNKNOWN;
+}
+
+void
+term_sync(void) {
+  char buf[8];
+
+  if (sgr_cur != sgr_want) {
+    ob_write(buf, sprintf(buf, "\x1B[%um", (unsigned)sgr_want));
+    sgr_cur = sgr_want;
+    ts_nsent++;
+  }
+
+  if (gl_cur != gl_want) {
+    ob_putc(gl_want ? 14 : 15);          // LS1 (SO) or LS0 (SI)
+    gl_cur = gl_want;
+    ts_nsent++;
+  }
+}
 
 // Select 'bold' character rendition.
+// This is particularly necessary on the VT340.
 void
 bold_sgr() {
-  fputs("\x1B[1m",stdout);
+  sgr_want = 1;
+  ts_nreq++;
 }
 
 // Select 'All attributes off' character rendition.
 void
 default_sgr(void) {
-  fputs("\x1B[0m",stdout);
+  sgr_want = 0;
+  ts_nreq++;
+}
+
+// Select custom character set.
+void
+custom_charset_select(void) {
+  gl_want = 1;                           // GL <- G1 (LS1 locking shift)
+  ts_nreq++;
+}
+
+// Select default character set.
+void
+default_charset_select(void) {
+  gl_want = 0;                           // GL <- G0 (LS0 locking shift)
+  ts_nreq++;
+}
+
+void
+ob_text(const void *buf, uint32_t len) {
+  term_sync();
+  ob_write(buf, len);
+  ob_nglyph += len;
+
+  if (cur_x < 0)
+    return;
+  // Past the last column, we would be in the "pending wrap"
+  // state. Do not go there.
+  if ((cur_x += len) >= SCRWIDTH)
+    cursor_lost();
+}
+
+void
+ob_texts(const char *s) {
+  ob_text(s, strlen(s));
 }
 
 // ------------------------------------------------------------
@@ -158,12 +501,13 @@ prep_terminal(void) {
 #endif                                   // _BSD44_CURSES
 #endif                                   // FORCE_CURSES
 
-  setbuf(stdout, NULL);
   setbuf(stdin, NULL);
 }
 
 void
 unprep_terminal(void) {
+  ob_sync();                             // Pending output goes first
+
 #ifndef FORCE_CURSES                     // The POSIX.1 way
   struct termios tio;
 
@@ -174,6 +518,8 @@ unprep_terminal(void) {
   endwin();                              // The curses way
   setbuf(stdout, NULL);
 #endif
+  cursor_lost();
+  term_lost();
 }
 
 // ------------------------------------------------------------
@@ -181,54 +527,269 @@ unprep_terminal(void) {
 
 void
 disable_cursor(void) {
-  fputs("\x1B[?25l", stdout);
+  ob_puts("\x1B[?25l");
 }
 
 void
 enable_cursor(void) {
-  fputs("\x1B[?25h", stdout);
+  ob_puts("\x1B[?25h");
+}
+
+// ------------------------------------------------------------
+// Forth support primitives: AT-XY PAGE CR MS KEY?
+
+// Cursor motion statistics. Savings are relative to a CUP
+// sequence with both parameters specified.
+uint32_t cm_saved = 0;         // Bytes saved, current frame
+uint32_t cm_saved_max = 0;     // Bytes saved, best frame
+uint32_t cm_saved_total = 0;   // Bytes saved, all frames
+
+uint32_t
+ndigits(uint32_t n) {
+  return n < 10 ? 1 : (n < 100 ? 2 : 3);
+}
+
+// -------------------------------------------------------------
+// Pre-encoded output. The byte strings for every CUP sequence,
+// every numeric parameter and every grid glyph are built once by
+// enc_init(), so that the render path boils down to memcpy()
+// into obuf, with no format parsing.
+
+typedef struct enc_t {
+  uint8_t len;
+  uint8_t seq[9];       // Room for "\x1B[24;80H" and sprintf's NUL
+} enc_t;
+
+enc_t cup_enc[SCRHEIGHT][SCRWIDTH]; // CUP. Parameters of 1 omitted
+enc_t dec_enc[1 + SCRWIDTH];        // Parameter values. 1 is omitted
+uint8_t glyph_enc[256][2];          // Grid character to DW pair. 0: illegal
+
+void
+enc_init(void) {
+  uint32_t x, y, n;
+  enc_t *e;
+
+  for (x = 0; x <= SCRWIDTH; x++)
+    dec_enc[x].len = x == 1 ? 0 :
+      sprintf((char *)dec_enc[x].seq, "%u", (unsigned)x);
+
+  for (y = 0; y < SCRHEIGHT; y++)
+    for (x = 0; x < SCRWIDTH; x++) {
+      e = &cup_enc[y][x];
+      memcpy(e->seq, "\x1B[", 2);
+      n = 2;
+      if (y)
+        n += sprintf((char *)e->seq + n, "%u", (unsigned)(1 + y));
+      if (x)
+        n += sprintf((char *)e->seq + n, ";%u", (unsigned)(1 + x));
+      e->seq[n++] = 'H';
+      e->len = n;
+    }
+
+  // 0x21 is the first user defined character.
+  memset(glyph_enc, 0, sizeof(glyph_enc));
+  glyph_enc[' '][0] = glyph_enc[' '][1] = ' ';
+  for (x = 'A'; x <= '^'; x++) {
+    glyph_enc[x][0] = 0x21 + ((x - 'A') << 1);   // Left half
+    glyph_enc[x][1] = glyph_enc[x][0] + 1;       // Right half
+  }
+}
+
+// Length of CSI <n> <final>.
+uint32_t
+cm_rel_len(uint32_t n) {
+  return 3 + dec_enc[n].len;
 }
 
-// Select custom character set.
 void
-custom_charset_select(void) {
-  putchar(14);                           // GL <- G1 (LS1 locking shift)
+cm_rel(uint32_t n, char final) {
+  ob_write("\x1B[", 2);
+  ob_write(dec_enc[n].seq, dec_enc[n].len);
+  ob_putc(final);
+}
+
+uint32_t
+cm_cup_len(int x, int y) {
+  return cup_enc[y][x].len;
 }
 
-// Select default character set.
 void
-default_charset_select(void) {
-  putchar(15);                           // GL <- G0 (LS0 locking shift)
+cm_cup(int x, int y) {
+  ob_write(cup_enc[y][x].seq, cup_enc[y][x].len);
 }
 
-// ------------------------------------------------------------
-// Forth support primitives: AT-XY PAGE CR MS KEY? KEY
+// Vertical motion: IND/RI for a single line, CUD/CUU otherwise.
+// LF is not used since the tty driver may turn it into CR LF.
+uint32_t
+cm_vert_len(int dy) {
+  if (!dy)
+    return 0;
+  if (dy == 1 || dy == -1)
+    return 2;
+  return cm_rel_len(dy < 0 ? -dy : dy);
+}
+
+void
+cm_vert(int dy) {
+  if (!dy)
+    return;
+  if (dy == 1)
+    ob_puts("\x1B" "D");                  // IND
+  else if (dy == -1)
+    ob_puts("\x1B" "M");                  // RI
+  else if (dy > 0)
+    cm_rel(dy, 'B');                     // CUD
+  else
+    cm_rel(-dy, 'A');                    // CUU
+}
+
+// Horizontal motion: CUF to the right. To the left: a few BSs,
+// CUB or CR followed by CUF, whichever is shortest.
+#define CM_BS 0
+#define CM_CUB 1
+#define CM_CR 2
+
+uint32_t
+cm_horiz_len(int x0, int x, uint32_t *how) {
+  uint32_t bestlen, len;
+
+  if (x >= x0)
+    return x == x0 ? 0 : cm_rel_len(x - x0);
+
+  *how = CM_BS;
+  bestlen = x0 - x;
+  if ((len = cm_rel_len(x0 - x)) < bestlen) {
+    *how = CM_CUB;
+    bestlen = len;
+  }
+  if ((len = 1 + (x ? cm_rel_len(x) : 0)) < bestlen) {
+    *how = CM_CR;
+    bestlen = len;
+  }
+  return bestlen;
+}
+
+void
+cm_horiz(int x0, int x, uint32_t how) {
+  if (x > x0) {
+    cm_rel(x - x0, 'C');                 // CUF
+    return;
+  }
+  if (x == x0)
+    return;
+
+  switch (how) {
+    case CM_BS:
+      for (; x0 > x; x0--)
+        ob_putc(8);
+      return;
+    case CM_CUB:
+      cm_rel(x0 - x, 'D');
+      return;
+    case CM_CR:
+      ob_putc(13);
+      if (x)
+        cm_rel(x, 'C');
+      return;
+  }
+}
 
 void
 at_xy(int x, int y) {
-  printf("\x1B[%d;%dH", 1 + y, 1 + x);
+  uint32_t cuplen = cm_cup_len(x, y),
+    rellen = cuplen, how = CM_BS;
+
+  if (cur_x >= 0)
+    rellen = cm_vert_len(y - cur_y) + cm_horiz_len(cur_x, x, &how);
+
+  if (rellen < cuplen) {
+    cm_vert(y - cur_y);
+    cm_horiz(cur_x, x, how);
+  }
+  else {
+    cm_cup(x, y);
+    rellen = cuplen;
+  }
+
+  cm_saved += (4 + ndigits(1 + y) + ndigits(1 + x)) - rellen;
+  cur_x = x;
+  cur_y = y;
 }
 
 // Clear the screen. VT100 style.
 void
 page(void) {
-  fputs("\x1B[H\x1B[J\x0D", stdout);
+  ob_puts("\x1B[H\x1B[J\x0D");
+  memset(scr_cur, ' ', sizeof(scr_cur));
+  cur_x = cur_y = 0;
 }
 
 void
 cr(void) {
-  putchar(10);
+  ob_putc(10);
+  cursor_lost();
+}
+
+// Wire accounting, last frame. See wire_account().
+typedef struct wire_t {
+  uint32_t nbyte;                // # bytes queued
+  uint32_t nesc;                 // # of which were not displayable
+  uint32_t nsyscall;             // # write(2) calls
+  uint32_t txms;                 // Transmit time at opt_baud
+} wire_t;
+
+wire_t wire_last;
+uint32_t wire_noverrun = 0;      // # frames longer than CLKPERIOD to send
+
+// Number of frames emitted so far.
+uint32_t nframe = 0;
+
+// Number of frames merged into the next one (-c).
+uint32_t nframe_coalesced = 0;
+
+// End of frame. Account for it and hand it over to the OS.
+void
+frame_end(void) {
+  nframe++;
+  cm_saved_total += cm_saved;
+  if (cm_saved > cm_saved_max)
+    cm_saved_max = cm_saved;
+  cm_saved = 0;
+
+  ob_commit(1);
+  wire_account();
 }
 
 void
 ms(uint32_t nms) {
   struct timespec rqt;
 
+  ob_flush();                            // Show what we have so far
+
   rqt.tv_sec = nms / 1000;
   rqt.tv_nsec = (nms % 1000) * 1000 * 1000;
   (void)nanosleep(&rqt, NULL);
 }
 
+// Exit gracefully after poll() has failed.
+void
+poll_failed(void) {
+  default_sgr();
+  unprep_terminal();
+  default_charset_select();
+#ifndef __VMS
+  at_xy(0, 23);
+#else
+  at_xy(0, 22);                          // Why???
+#endif
+  term_sync();
+  ob_sync();
+  setbuf(stderr, NULL);
+  perror("poll() failed");
+  enable_cursor();
+  exit(1);
+}
+
 uint32_t
 key_question(void) {
   struct pollfd pfds[1];
@@ -236,92 +797,254 @@ key_question(void) {
 
   pfds[0].fd = fileno(stdin);
   pfds[0].events = POLLIN;
-  retval = poll(pfds, (nfds_t)1, 1);
-  if (retval == -1) {
-    default_sgr();
-    unprep_terminal();
-    default_charset_select();
-#ifndef __VMS
-    at_xy(0, 23);
-#else
-    at_xy(0, 22);                        // Why???
-#endif
-    setbuf(stderr, NULL);
-    perror("poll() failed");
-    enable_cursor();
-    exit(1);
-  }
+  retval = poll(pfds, (nfds_t)1, 0);
+  if (retval == -1)
+    poll_failed();
   return retval == 1;
 }
 
-// Note: this will be blocking unless a previous call to
-// key_question() returned NZ.
-uint8_t
-key(void) {
-// Bypass curses for all terminal I/Os. The library is way too smart.
-  uint8_t val;
+// -------------------------------------------------------------
+// Clock cycle scheduler. Cycles end at absolute deadlines on
+// CLOCK_MONOTONIC, so that rendering and polling times do not
+// add up to CLKPERIOD and the game speed does not depend on the
+// terminal bandwidth. When a deadline is missed, the next cycles
+// run back to back until we are on time again (catch up), unless
+// -d is specified or we are more than TICK_MAXLAG cycles late, in
+// which case the missed cycles are dropped.
+
+#define TICK_MAXLAG 5
+#define NHIST 16
+
+struct timespec tick_due;        // End of the current clock cycle
+
+// Scheduler statistics. Histogram buckets are powers of two:
+// bucket 0 is < 1, bucket n is [2^(n-1), 2^n), the last one is
+// open ended.
+uint32_t tick_n = 0;             // # clock cycles
+uint32_t tick_nmissed = 0;       // # deadlines missed
+uint32_t tick_ndropped = 0;      // # clock cycles dropped
+uint32_t tick_jitter[NHIST];     // Wake up lateness, microseconds
+uint32_t tick_overrun[NHIST];    // Deadline overruns, milliseconds
+
+void
+ts_add_ms(struct timespec *ts, uint32_t nms) {
+  ts->tv_sec += nms / 1000;
+  ts->tv_nsec += (nms % 1000) * 1000 * 1000;
+  if (ts->tv_nsec >= 1000 * 1000 * 1000) {
+    ts->tv_nsec -= 1000 * 1000 * 1000;
+    ts->tv_sec++;
+  }
+}
 
-  (void)read(fileno(stdin), &val, 1);
-  return val;
+// Returns a - b in microseconds.
+int64_t
+ts_diff_us(struct timespec *a, struct timespec *b) {
+  return (int64_t)(a->tv_sec - b->tv_sec) * 1000000 +
+    (a->tv_nsec - b->tv_nsec) / 1000;
 }
 
-// Drain terminal output (DECXCPR).
 void
-tty_drain(void) {
-  fputs("\x1B[5n", stdout);
-  (void)key(); (void)key();              // Skip CSI in the reply
-  (void)key(); (void)key();              // 0n is OK, 3n indicates a malfunction
+hist_add(uint32_t *hist, int64_t val) {
+  uint32_t n = 0;
+
+  while (val > 0 && n < NHIST - 1) {
+    val >>= 1;
+    n++;
+  }
+  hist[n]++;
 }
 
 // ------------------------------------------------------------
-// VT420/VT340 specific material.
+// Terminal synchronization. A DSR request ("\x1B[5n") is answered
+// with "\x1B[0n" (or "\x1B[3n" on a malfunction) once the terminal
+// has processed everything sent before it. The reply is picked up
+// by the keyboard input parser, so nobody waits for it. The round
+// trip time is how far behind the game the terminal is.
 
-const uint32_t pfn = 1;
-const uint32_t pcn = 1;                  // First soft character at $21
-const uint32_t pe = 1;                   // Erase only new definitions
-#define PCMW 10                          // Chr width is 10 pix in 80 col mode
-const uint32_t pss = 0;                  // 80 columns, 24 lines
-const uint32_t pt = 2;                   // Full cell
+uint32_t dsr_pending = 0;        // TRUE if a request is outstanding
+struct timespec dsr_sent;        // When it was sent
 
-#ifdef VT420
-#define PCMH 16                          // Chr height is 16: 6/6/4 in sixels
-#elif defined(VT340)
-#define PCMH 20                          // Chr height is 20: 6/6/6/2 in sixels
-#else
-#error "Unsupported target terminal"
-#endif
+// Round trip statistics, in microseconds.
+uint32_t dsr_n = 0;              // # replies
+uint32_t dsr_nbad = 0;           // # of which reported a malfunction
+uint32_t dsr_rtt_last = 0;
+uint32_t dsr_rtt_min = 0;
+uint32_t dsr_rtt_max = 0;
+uint64_t dsr_rtt_sum = 0;
 
-const uint32_t pcss = 0;                 // 94-charset
-const uint8_t ufn = 'U';                 // User font name. Argument to DSCS
+void
+dsr_request(void) {
+  if (dsr_pending)
+    return;                      // One at a time
 
-#define NSIXEL ((PCMH + 5) / 6) // Sixels per column
+  ob_puts("\x1B[5n");
+  ob_flush();
+  (void)clock_gettime(CLOCK_MONOTONIC, &dsr_sent);
+  dsr_pending = 1;
+}
 
+// Called by the keyboard input parser.
 void
-dscs(void) {
-  putchar(ufn);
+dsr_reply(uint32_t status) {
+  struct timespec now;
+  uint32_t rtt;
+
+  if (!dsr_pending)
+    return;                      // Unsolicited
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  rtt = (uint32_t)ts_diff_us(&now, &dsr_sent);
+  dsr_pending = 0;
+
+  if (status)
+    dsr_nbad++;
+  if (!dsr_n++ || rtt < dsr_rtt_min)
+    dsr_rtt_min = rtt;
+  if (rtt > dsr_rtt_max)
+    dsr_rtt_max = rtt;
+  dsr_rtt_sum += rtt;
+  dsr_rtt_last = rtt;
 }
 
-// Define character set.
+// Start a new clock cycle now. This is required after anything
+// that does not follow the clock (level entry, PM's death).
 void
-dcs(void) {
-  fputs("\x1BP", stdout);
+tick_resync(void) {
+  (void)clock_gettime(CLOCK_MONOTONIC, &tick_due);
+  ts_add_ms(&tick_due, CLKPERIOD);
 }
 
-// Emit string terminator.
 void
-st(void) {
-  fputs("\x1B\\", stdout);
+sleep_until(struct timespec *due) {
+#if defined(TIMER_ABSTIME) && !defined(__VMS)
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, due, NULL) == EINTR)
+    ;
+#else
+  struct timespec now, rqt;
+  int64_t us;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  if ((us = ts_diff_us(due, &now)) <= 0)
+    return;
+  rqt.tv_sec = us / 1000000;
+  rqt.tv_nsec = (us % 1000000) * 1000;
+  (void)nanosleep(&rqt, NULL);
+#endif
 }
 
-// Emit a semi-column character.
+// Wait until 'due', processing keyboard input as it arrives.
 void
-semcol_emit(void) {
-  putchar(';');
-}
+wait_until(struct timespec *due) {
+  struct pollfd pfds[1];
+  struct timespec now;
+  int64_t us;
 
-// Ghosts are: Blinky (red), Pinky (pink), Inky (cyan)
-// and Clyde (orange). This is a monochrome rendition so that
-// effect will be lost...
+  pfds[0].fd = fileno(stdin);
+  pfds[0].events = POLLIN;
+
+  for (;;) {
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((us = ts_diff_us(due, &now)) <= 0)
+      return;
+    if (us < 1000) {                     // poll() has a 1 ms resolution
+      sleep_until(due);
+      return;
+    }
+
+    switch (poll(pfds, (nfds_t)1, (int)(us / 1000))) {
+      case -1:
+        if (errno != EINTR)
+          poll_failed();
+        break;
+      case 1:
+        keyboard_input_process();
+        break;
+    }
+  }
+}
+
+// End of clock cycle.
+void
+tick_wait(void) {
+  struct timespec now;
+  int64_t late;
+
+  ob_flush();                            // Show what we have so far
+  tick_n++;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  if ((late = ts_diff_us(&now, &tick_due)) >= 0) {
+    tick_nmissed++;
+    hist_add(tick_overrun, late / 1000);
+
+    if (!opt_tickdrop && late < TICK_MAXLAG * CLKPERIOD * 1000) {
+      ts_add_ms(&tick_due, CLKPERIOD);   // Catch up: no sleep
+      keyboard_input_process();
+      return;
+    }
+
+    // Skip to the next deadline still ahead of us.
+    do {
+      ts_add_ms(&tick_due, CLKPERIOD);
+      tick_ndropped++;
+    } while (ts_diff_us(&now, &tick_due) >= 0);
+  }
+
+  wait_until(&tick_due);
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  hist_add(tick_jitter, ts_diff_us(&now, &tick_due));
+  ts_add_ms(&tick_due, CLKPERIOD);
+}
+
+// ------------------------------------------------------------
+// VT420/VT340 specific material.
+
+const uint32_t pfn = 1;
+const uint32_t pcn = 1;                  // First soft character at $21
+const uint32_t pe = 1;                   // Erase only new definitions
+#define PCMW 10                          // Chr width is 10 pix in 80 col mode
+const uint32_t pss = 0;                  // 80 columns, 24 lines
+const uint32_t pt = 2;                   // Full cell
+
+#ifdef VT420
+#define PCMH 16                          // Chr height is 16: 6/6/4 in sixels
+#elif defined(VT340)
+#define PCMH 20                          // Chr height is 20: 6/6/6/2 in sixels
+#else
+#error "Unsupported target terminal"
+#endif
+
+const uint32_t pcss = 0;                 // 94-charset
+const uint8_t ufn = 'U';                 // User font name. Argument to DSCS
+
+#define NSIXEL ((PCMH + 5) / 6) // Sixels per column
+
+void
+dscs(void) {
+  ob_putc(ufn);
+}
+
+// Define character set.
+void
+dcs(void) {
+  ob_puts("\x1BP");
+}
+
+// Emit string terminator.
+void
+st(void) {
+  ob_puts("\x1B\\");
+}
+
+// Emit a semi-column character.
+void
+semcol_emit(void) {
+  ob_putc(';');
+}
+
+// Ghosts are: Blinky (red), Pinky (pink), Inky (cyan)
+// and Clyde (orange). This is a monochrome rendition so that
+// effect will be lost...
 
 #ifdef VT420
 #include "sf420-hex.c"
@@ -332,25 +1055,75 @@ semcol_emit(void) {
 // The following is twice the number of double width chars.
 #define NCHAR (((int)sizeof(softfont))/(PCMW*NSIXEL))
 
-void
-softfont_emit(void) {
-  int i, j, k;
+// The sixel repeat introducer ("!<n><sixel>") is part of the
+// sixel graphics protocol. The VT420 and VT340 documentation does
+// not allow it in DECDLD sixel bit patterns, so the literal
+// stream is sent unless DECDLD_REPEAT is defined at compile time.
+#ifdef DECDLD_REPEAT
+const uint32_t dld_repeat = 1;
+#else
+const uint32_t dld_repeat = 0;
+#endif
+
+// Encode a run of 'n' sixels 'c'. Returns the byte count. Nothing
+// is emitted unless 'emit' is NZ.
+uint32_t
+sixel_run(uint8_t c, uint32_t n, uint32_t rle, uint32_t emit) {
+  char buf[16];                          // "!4294967295?"
+  uint32_t len;
+
+  if (rle && n >= 4) {                   // "!4?" is shorter than "????"
+    len = sprintf(buf, "!%u%c", (unsigned)n, c);
+    if (emit)
+      ob_write(buf, len);
+    return len;
+  }
+
+  if (emit)
+    for (len = 0; len < n; len++)
+      ob_putc(c);
+  return n;
+}
+
+// Encode the font definition. Returns the byte count.
+uint32_t
+softfont_encode(uint32_t rle, uint32_t emit) {
+  uint32_t i, j, k, n, len = 0;
 
   for (k = 0; k < NCHAR; k++) {          // Iterate over char. defs
     for (j = 0; j < NSIXEL; j++) {       // Iterate over sixel groups
-      for (i = 0; i < PCMW; i++)         // Iterate over col. defs
-        putchar('?' + softfont[k][i][j]);
-      if (j != NSIXEL - 1)
-        putchar('/');                    // Group delimiter
+      for (i = 0; i < PCMW; i += n) {    // Iterate over col. runs
+        for (n = 1; i + n < PCMW &&
+          softfont[k][i + n][j] == softfont[k][i][j]; n++)
+          ;
+        len += sixel_run('?' + softfont[k][i][j], n, rle, emit);
+      }
+      if (j != NSIXEL - 1) {
+        if (emit)
+          ob_putc('/');                  // Group delimiter
+        len++;
+      }
+    }
+    if (k != NCHAR - 1) {
+      if (emit)
+        semcol_emit();                   // Character delimiter
+      len++;
     }
-    if (k != NCHAR - 1)
-      semcol_emit();                     // Character delimiter
   }
+
+  return len;
+}
+
+void
+softfont_emit(void) {
+  (void)softfont_encode(dld_repeat, 1);
 }
 
 void
 decsend(uint8_t c) {
-  printf("%u", (unsigned)c);
+  char buf[4];
+
+  ob_write(buf, sprintf(buf, "%u", (unsigned)c));
 }
 
 // DECDLD spec:
@@ -363,90 +1136,199 @@ decdld(void) {
   decsend(pe);   semcol_emit(); decsend(PCMW); semcol_emit();
   decsend(pss);  semcol_emit(); decsend(pt);   semcol_emit();
   decsend(PCMH); semcol_emit(); decsend(pcss);
-  putchar('{'); dscs();
+  ob_putc('{'); dscs();
   softfont_emit();
   st();
+}
 
-  // Charset designation.
-  fputs("\x1B)", stdout); dscs();        // G1 <- <UserFontName>
+// Charset designation.
+void
+g1_designate(void) {
+  ob_puts("\x1B)"); dscs();        // G1 <- <UserFontName>
+}
+
+// -------------------------------------------------------------
+// Soft font cache. Neither the VT420 nor the VT340 can be asked
+// which DRCS font it holds. So the CRC-32 of the DECDLD string we
+// sent is recorded in a per-tty file and the upload is skipped
+// when the same string would be sent again to the same device.
+// Use -f if the terminal has been reset or power cycled since.
+
+uint32_t dld_skipped = 0;        // TRUE if the upload was skipped
+
+// Cache file name for the tty on stdout. Returns 0 if none.
+uint32_t
+fontcache_path(char *path, uint32_t size) {
+#ifndef __VMS
+  char *tty, *home, *p;
+  int n;
+
+  if (!(tty = ttyname(STDOUT_FILENO)) || !(home = getenv("HOME")))
+    return 0;
+  if (!strncmp(tty, "/dev/", 5))
+    tty += 5;
+
+  n = snprintf(path, size, "%s/.pacman-drcs-", home);
+  if (n < 0 || (uint32_t)n + strlen(tty) >= size)
+    return 0;
+  for (p = path + n; *tty; tty++)
+    *p++ = *tty == '/' ? '_' : *tty;
+  *p = 0;
+  return 1;
+#else
+  (void)path; (void)size;
+  return 0;                      // No fast path under VMS
+#endif
+}
+
+// Returns NZ if 'crc' is what was last uploaded to this tty.
+uint32_t
+fontcache_hit(uint32_t crc) {
+  char path[256];
+  unsigned cached;
+  FILE *fp;
+  int n;
+
+  if (!fontcache_path(path, sizeof(path)) || !(fp = fopen(path, "r")))
+    return 0;
+  n = fscanf(fp, "%x", &cached);
+  fclose(fp);
+  return n == 1 && cached == crc;
 }
 
-// Used by PM when entering/leaving the "supercharged" state.
 void
-bell(void) {
-  if (silent)
-    return;
+fontcache_update(uint32_t crc) {
+  char path[256];
+  FILE *fp;
 
-  default_charset_select();
-  putchar(7);
-  custom_charset_select();
+  if (!fontcache_path(path, sizeof(path)) || !(fp = fopen(path, "w")))
+    return;                      // The next run will upload again
+  fprintf(fp, "%08x\n", (unsigned)crc);
+  fclose(fp);
 }
 
-// ------------------------------------------------------------
+// Upload the soft font unless the terminal already has it. The
+// DECDLD string is assembled in an empty obuf, fingerprinted, then
+// either sent or dropped. If it did not fit, part of it has gone
+// out already: it is sent in full and not cached, as the CRC only
+// covers the tail.
+void
+softfont_load(void) {
+  uint32_t crc, noverflow = ob_noverflow;
+
+  ob_flush();
+  decdld();
+  if (ob_noverflow != noverflow) {
+    ob_flush();
+    return;
+  }
+  crc = crc32(obuf, oblen);
 
-// We define this enumeration so that opposite(dir) is
-// dir 2 + 3 AND (modulo 4) for dir in [0..3].
-typedef enum dir_t {
-  dir_up,
-  dir_left,
-  dir_down,
-  dir_right,
-  dir_blocked,                           // Must be 1 + dir_right
-  dir_unspec,                            // Invalid except for idir (pacman)
-  dir_quit                               // Inv. exc. as retval/pacman.dirselect
-} dir_t;
+  if (!opt_reload && fontcache_hit(crc)) {
+    oblen = 0;                   // Drop it
+    dld_skipped = 1;
+    return;
+  }
+
+  ob_flush();                    // The font goes out on its own
+  fontcache_update(crc);
+}
 
+// Used by PM when entering/leaving the "supercharged" state.
 void
-entity_vector_init(void) {
-  // By convention, we have PM as instance #0.
-  // This is a central assumption though!
-  entvec[0] = entity_new(-1, -1, 34, 32, dir_right);
+bell(void) {
+  if (silent)
+    return;
 
-  // Blinky is entity #1, Red, default design. North central ghost.
-  entvec[1] = entity_new(4, 60, 14, 32, dir_left);
+  ob_putc(7);                            // GL does not matter here
+}
 
-  // Pinky is entity #2, Pink, frowning. Central ghost.
-  entvec[2] = entity_new(4, 2, 20, 32, dir_up);
+// Font definition size, literal and with sixel repeats.
+void
+softfont_report(FILE *fp) {
+  fprintf(fp, "DECDLD font:     %u bytes literal, %u with sixel "
+    "repeats (%s)\n", (unsigned)softfont_encode(0, 0),
+    (unsigned)softfont_encode(1, 0), dld_skipped ? "not sent, cached" :
+    (dld_repeat ? "latter sent" : "former sent"));
+}
 
-  // Inky is entity #3, Cyan, nosy. Western ghost.
-  entvec[3] = entity_new(40, 62, 20, 30, dir_down);
+// Print the non empty buckets of a histogram as <lower bound>:<count>.
+void
+hist_report(char *title, uint32_t *hist) {
+  uint32_t i;
 
-  // Clyde is entity #4, Orange, smiling, Eastern ghost.
-  entvec[4] = entity_new(40, 2, 20, 34, dir_left);
+  fprintf(stderr, "%s", title);
+  for (i = 0; i < NHIST; i++)
+    if (hist[i])
+      fprintf(stderr, " %s%u:%u", i == NHIST - 1 ? ">=" : "",
+        i ? 1u << (i - 1) : 0, (unsigned)hist[i]);
+  fprintf(stderr, "\n");
 }
 
+// Output statistics go to stderr, once the terminal has been
+// restored.
 void
-initvars(void) {
-  serialno = 0;
-  entity_vector_init();
+stats_report(void) {
+  if (!opt_stats)
+    return;
 
-  hiscore = 0;      // Make this somehow persistent!
-  score = 0;
-  lives = 3;
-  gamlev = 0;
-  bonus = 0;
-  suptim = 0;
-  gm_timer_en = -1; // Enable ghost mode scheduler
-  nremitem = 0;     // Force level entry initializations
+  fprintf(stderr, "frames:          %u (%u coalesced)\n", (unsigned)nframe,
+    (unsigned)nframe_coalesced);
+  fprintf(stderr, "bytes written:   %u (%u per frame)\n",
+    (unsigned)ob_nbyte, (unsigned)(nframe ? ob_nbyte / nframe : 0));
+  fprintf(stderr, "write() calls:   %u\n", (unsigned)ob_syscalls());
+  fprintf(stderr, "obuf overflows:  %u (high water mark %u/%u)\n",
+    (unsigned)ob_noverflow, (unsigned)ob_hiwat, (unsigned)OBUFSIZE);
+  fprintf(stderr, "cursor motion:   %u bytes saved (%u per frame, "
+    "max %u)\n", (unsigned)cm_saved_total,
+    (unsigned)(nframe ? cm_saved_total / nframe : 0),
+    (unsigned)cm_saved_max);
+  fprintf(stderr, "shifts/SGRs:     %u sent, %u requested\n",
+    (unsigned)ts_nsent, (unsigned)ts_nreq);
+  fprintf(stderr, "line overruns:   %u frames (%u baud, %u ms clock)\n",
+    (unsigned)wire_noverrun, (unsigned)opt_baud, (unsigned)CLKPERIOD);
+  fprintf(stderr, "clock cycles:    %u (%u deadlines missed, %u cycles "
+    "dropped)\n", (unsigned)tick_n, (unsigned)tick_nmissed,
+    (unsigned)tick_ndropped);
+  hist_report("tick jitter us:  ", tick_jitter);
+  hist_report("tick overrun ms: ", tick_overrun);
+  fprintf(stderr, "terminal lag:    %u replies (%u bad), last %u us, "
+    "min %u us, avg %u us, max %u us\n", (unsigned)dsr_n, (unsigned)dsr_nbad,
+    (unsigned)dsr_rtt_last, (unsigned)dsr_rtt_min,
+    (unsigned)(dsr_n ? dsr_rtt_sum / dsr_n : 0), (unsigned)dsr_rtt_max);
+#ifdef OB_THREAD
+  if (ring_on)
+    fprintf(stderr, "output ring:     high water mark %u/%u, %u waits, "
+      "%u frames dropped\n", (unsigned)ring_hiwat, (unsigned)RINGSIZE,
+      (unsigned)ring_nwait, (unsigned)ring_ndrop);
+#endif
+  softfont_report(stderr);
+  fprintf(stderr, "game digest:     %08x after %u steps\n",
+    (unsigned)game_digest(&game), (unsigned)game.tick);
 }
 
 void
 finalize(void) {
+  inlog_close();
   default_sgr();
   unprep_terminal();
   default_charset_select();
 
 #ifdef __VMS               // XXX Why do we have to do that?
   at_xy(0, 11);
-  fputs("        ", stdout);
+  ob_texts("        ");
 #endif
 
   at_xy(0, 23);
-  fputs("Interrupted!", stdout);
+  ob_texts("Interrupted!");
 #ifndef __VMS              // DCL does that for us!
   cr();
 #endif
   enable_cursor();
+  term_sync();
+  ob_sync();
+  stats_report();
+  wire_dump();
   exit(0);
 }
 
@@ -465,83 +1347,196 @@ init_signal_processing(void) {
 
 void
 initialize(void) {
-  initvars();
+  enc_init();
+  if (opt_ai == ai_maze)
+    mazedist_build(&mazedist);
+  game_init(&game);
+  game_set_ghostai(&game, opt_ai, &mazedist);
   prep_terminal();
   page();
   disable_cursor();        // Cursor off
-  fputs("\x1B F", stdout); // 7-bit C1 control characters
+  ob_puts("\x1B F");       // 7-bit C1 control characters
   bold_sgr();
-  decdld();                // Upload charset definition
+  softfont_load();         // Upload charset definition
+  g1_designate();
+  ob_flush();
+#ifdef OB_THREAD
+  if (opt_async)
+    ring_start();
+#endif
+  wire_mark();             // Frames are accounted for from here
   custom_charset_select(); // Select custom character set
   init_signal_processing();
 }
 
 void
 dot_var(uint32_t var) {
-  printf("%08d", var);
-}
+  char buf[16];
+
+  ob_text(buf, sprintf(buf, "%08u", (unsigned)var));
+}
+
+// Status panel. Counters are not displayed when updated. They
+// are marked dirty and status_render() emits all of them in one
+// batch per frame, so that the default character set only gets
+// selected once.
+typedef enum stfield_t {
+  st_hiscore,
+  st_score,
+  st_lives,
+  st_level,
+  st_bonus,
+  st_suptim,
+  st_wbytes,                     // Wire overlay (-w) from here on
+  st_wesc,
+  st_wcalls,
+  st_wtxms,
+  st_wover,
+  st_nfield
+} stfield_t;
+
+#define ST_WIRE (((1 << st_nfield) - 1) & ~((1 << st_wbytes) - 1))
+
+typedef struct stfield {
+  uint32_t *var;
+  uint8_t col, row;
+} stfield;
+
+stfield st_field[st_nfield] = {
+  { &game.hiscore,        0, 1 },
+  { &game.score,          0, 4 },
+  { &game.lives,          0, 7 },
+  { &game.gamlev,         0, 10 },
+  { &game.bonus,          0, 13 },
+  { &game.suptim,         0, 16 },
+  { &wire_last.nbyte,     6, 18 },
+  { &wire_last.nesc,      6, 19 },
+  { &wire_last.nsyscall,  6, 20 },
+  { &wire_last.txms,      6, 21 },
+  { &wire_noverrun,       6, 22 }
+};
+uint32_t st_dirty = 0;           // Bitmap of stfield_t values
 
 void
-update_score(uint32_t delta) {
-  score += delta;
+status_render(void) {
+  uint32_t i;
+
+  if (!opt_overlay)
+    st_dirty &= ~ST_WIRE;
+  if (!st_dirty)
+    return;
+
   default_charset_select();
-  at_xy(0, 4);
-  dot_var(score);
+  for (i = 0; i < st_nfield; i++)
+    if (st_dirty & (1 << i)) {
+      at_xy(st_field[i].col, st_field[i].row);
+      dot_var(*st_field[i].var);
+    }
+  st_dirty = 0;
   custom_charset_select();
 }
 
+// Display all counters.
 void
-update_lives(void) {
-  lives--;                 // Always goes down!
-  default_charset_select();
-  at_xy(0, 7);
-  dot_var(lives);
-  custom_charset_select();
+dot_sitrep(void) {
+  st_dirty = (1 << st_nfield) - 1;
+  status_render();
 }
 
+// Print status headers. Forces in the default character set and
+// leaves in custom character set mode.
 void
-update_level(void) {
-  gamlev++;
+dot_init_sitrep(void) {
   default_charset_select();
-  at_xy(0, 10);
-  dot_var(gamlev);
+  at_xy(0, 0);  ob_texts("Highscore");
+  at_xy(0, 3);  ob_texts("Score");
+  at_xy(0, 6);  ob_texts("Lives");
+  at_xy(0, 9);  ob_texts("Level");
+  at_xy(0, 12); ob_texts("Bonus");
+  at_xy(0, 15); ob_texts("Supertime");
+  if (opt_overlay) {
+    at_xy(0, 18); ob_texts("Bytes");
+    at_xy(0, 19); ob_texts("Esc");
+    at_xy(0, 20); ob_texts("Calls");
+    at_xy(0, 21); ob_texts("Tx ms");
+    at_xy(0, 22); ob_texts("Overr");
+  }
+  dot_sitrep();
   custom_charset_select();
 }
 
+// -------------------------------------------------------------
+// Wire accounting. What each frame cost on the line, as seen by
+// the output layer. Bytes are assumed to be sent as 8N1, i.e. 10
+// bits each. The counters can be displayed in the status panel
+// (-w), where they describe the previous frame, and the whole
+// series can be dumped as CSV on exit (-o).
+
+uint32_t wire_nqueued0 = 0;      // Counter values at the last frame end
+uint32_t wire_nglyph0 = 0;
+uint32_t wire_nsyscall0 = 0;
+
+wire_t *wire_log = NULL;         // One entry per frame (-o)
+uint32_t wire_nlog = 0;
+uint32_t wire_maxlog = 0;
+
+// Start accounting from here.
 void
-update_suptim(void) {
-  suptim += CLKPERIOD / 5;
-  default_charset_select();
-  at_xy(0, 16);
-  dot_var(suptim);
-  custom_charset_select();
+wire_mark(void) {
+  wire_nqueued0 = ob_nqueued;
+  wire_nglyph0 = ob_nglyph;
+  wire_nsyscall0 = ob_syscalls();
 }
 
-// This routine should only be called when the default character
-// set is in effect. Otherwise things will look ugly.
 void
-dot_sitrep(void) {
-  at_xy(0, 1);  dot_var(hiscore);
-  at_xy(0, 4);  dot_var(score);
-  at_xy(0, 7);  dot_var(lives);
-  at_xy(0, 10); dot_var(gamlev);
-  at_xy(0, 13); dot_var(bonus);
-  at_xy(0, 16); dot_var(suptim);
+wire_account(void) {
+  wire_t *w = &wire_last, *p;
+
+  w->nbyte = ob_nqueued - wire_nqueued0;
+  w->nesc = w->nbyte - (ob_nglyph - wire_nglyph0);
+  w->nsyscall = ob_syscalls() - wire_nsyscall0;
+  w->txms = (w->nbyte * 10 * 1000 + opt_baud - 1) / opt_baud;
+  if (w->txms > CLKPERIOD)
+    wire_noverrun++;
+  wire_mark();
+
+  if (opt_overlay)
+    st_dirty |= ST_WIRE;
+
+  if (!opt_csv)
+    return;
+  if (wire_nlog == wire_maxlog) {
+    // Out of memory: the series is truncated.
+    if (!(p = realloc(wire_log, 2 * (wire_maxlog + 512) * sizeof(wire_t))))
+      return;
+    wire_log = p;
+    wire_maxlog = 2 * (wire_maxlog + 512);
+  }
+  wire_log[wire_nlog++] = *w;
 }
 
-// Print status headers. Forces in the default character set and
-// leaves in custom character set mode.
 void
-dot_init_sitrep(void) {
-  default_charset_select();
-  at_xy(0, 0);  fputs("Highscore", stdout);
-  at_xy(0, 3);  fputs("Score", stdout);
-  at_xy(0, 6);  fputs("Lives", stdout);
-  at_xy(0, 9);  fputs("Level", stdout);
-  at_xy(0, 12); fputs("Bonus", stdout);
-  at_xy(0, 15); fputs("Supertime", stdout);
-  dot_sitrep();
-  custom_charset_select();
+wire_dump(void) {
+  uint32_t i;
+  wire_t *w;
+  FILE *fp;
+
+  if (!opt_csv)
+    return;
+  if (!(fp = fopen(opt_csv, "w"))) {
+    perror(opt_csv);
+    return;
+  }
+
+  fprintf(fp, "frame,bytes,esc_bytes,glyph_bytes,syscalls,tx_ms,overrun\n");
+  for (i = 0; i < wire_nlog; i++) {
+    w = &wire_log[i];
+    fprintf(fp, "%u,%u,%u,%u,%u,%u,%u\n", (unsigned)(1 + i),
+      (unsigned)w->nbyte, (unsigned)w->nesc, (unsigned)(w->nbyte - w->nesc),
+      (unsigned)w->nsyscall, (unsigned)w->txms,
+      (unsigned)(w->txms > CLKPERIOD));
+  }
+  fclose(fp);
 }
 
 // Grid definition language:
@@ -586,38 +1581,31 @@ dot_init_sitrep(void) {
 // A variant of finalize().
 void
 crash_and_burn(char *errmsg) {
+  inlog_close();
+  status_render();         // E.g. lives dropping to zero
   default_sgr();
   unprep_terminal();
   default_charset_select();
   at_xy(0, 23);
-  fputs(errmsg, stdout);
+  ob_texts(errmsg);
 #ifndef __VMS              // DCL does that for us!
   cr();
 #endif
   enable_cursor();
+  term_sync();
+  ob_sync();
+  stats_report();
+  wire_dump();
   exit(0);
 }
 
-// Display doublewidth character at offset 'c'.
-// 0x21 is the first user defined character.
-void
-dot_dwchar(uint8_t c) {
-  c += 0x21;
-  printf("%c%c", c, 1 + c);
-}
-
 void
 dot_grid_char(uint8_t gc) {
-  if (gc == ' ') {
-    fputs("  ", stdout);
-    return;
-  }
-
   // Defensive programming.
-  if (!(gc >= 'A' && gc <= '^'))
+  if (!glyph_enc[gc][0])
     crash_and_burn("dot_grid_char: illegal character");
 
-  dot_dwchar((gc - 'A') << 1);
+  ob_text(glyph_enc[gc], 2);
 }
 
 // Directly (Yeah?) referenced DW character printing primitives.
@@ -772,1155 +1760,563 @@ dot_rclyde(void) {
   dot_grid_char('^');
 }
 
-void
-display_line(char *saddr, uint32_t lineno) {
-  uint32_t i;
-
-  if (strlen(saddr) != NCOL)
-    crash_and_burn("display_line: incorrect column count");
-
-  at_xy(X0, lineno);
-  for (i = 0; i < NCOL; i++) {
-    grid[lineno * NCOL + i] = saddr[i]; // Grid initialization.
-
-    dot_grid_char(saddr[i]);
-  }
-}
-
-// Display the initial grid contents.
-// Note: this assumes custom-charset-select is in effect.
-// By design no instanciated object should be referenced here.
-void
-dot_initial_grid(void) {
-  // 33 columns (double width characters) by 23 rows.
-  display_line("AEEEEEEEGEEEEEEEEEEEEEEEGEEEEEEEB", 0);
-  display_line("FL K K KFK K K K K K K KFK K K LF", 1);
-  display_line("F AEEEP Q OEEEEEEEEEEEP Q OEEEB F", 2);
-  display_line("FKFK K K K K K K K K K K K K KFKF", 3);
-  display_line("F Q S S OEP OEEEEEEEP OEP S S Q F", 4);
-  display_line("FK KFKFK K K K K K K K K KFKFK KF", 5);
-  display_line("JEP F Q OEEEB OEEEP AEEEP Q F OEI", 6);
-  display_line("FK KFK K K KFK K K KFK K K KFK KF", 7);
-  display_line("F S Q OEEEB F ATTTB F AEEEP Q S F", 8);
-  display_line("FKFK K K KFKFKF   FKFKFK K K KFKF", 9);
-  display_line("F F OEEEP F F F   F F F OEEEP F F", 10);
-  display_line("FKFK K K KFKFKF   FKFKFK K K KFKF", 11);
-  display_line("F CEP S S Q Q CEEED Q Q S S OED F", 12);
-  display_line("FK K KFKFK K K K K K K KFKFK K KF", 13);
-  display_line("F OEEED Q S OEEEEEEEP S Q CEEEP F", 14);
-  display_line("FK K K K KFK K K K K KFK K K K KF", 15);
-  display_line("F OEGEEEP Q OEEEEEEEP Q OEEEGEP F", 16);
-  display_line("FK KFK K K K K K K K K K K KFK KF", 17);
-  display_line("JEP F OEP S OEEEEEEEP S OEP F OEI", 18);
-  display_line("FK KFK K KFK K K K K KFK K KFK KF", 19);
-  display_line("F OEHEEEP F OEEEEEEEP F OEEEHEP F", 20);
-  display_line("FL K K K KFK K K K K KFK K K K LF", 21);
-  display_line("CEEEEEEEEEHEEEEEEEEEEEHEEEEEEEEED", 22);
-  nremitem = NITEM;
-}
-
 // ------------------------------------------------------------
-// Animation objects.
-
-typedef void (*method)(void *);
-
-// Caution here: some of the 8 bit fields may have to be signed!
-typedef struct entity {
-  method  strategy; // Strategy (moving) method
-  method  display;  // Display method
-  uint8_t resurr;   // # Clock ticks till we're back (ghosts)
-  uint8_t reward;   // # points for killing a ghost / 100 (PM)
-  uint8_t vrown;    // Virtual row number
-  uint8_t pcoln;    // Physical column number
-  uint8_t ivrown;   // Interfering virtual row number (ghosts)
-  uint8_t ipcoln;   // Interfering pcol number (ghosts)
-  uint8_t igchr;    // Interfering grid character (ghosts)
-  uint8_t pcol0;    // Initial pcol number
-  uint8_t vrow0;    // Initial vrow number
-  uint8_t dir0;     // Initial direction
-  uint8_t hcvrn;    // Home corner vrow# (ghosts)
-  uint8_t hcpcn;    // Home corner pcol# (ghosts)
-  uint8_t cdir;     // Current direction
-  uint8_t pdir;     // Previous direction
-  uint8_t idir;     // Intended direction (PM)
-  uint8_t revflg;   // Reverse direction directive (ghosts)
-  uint8_t inited;   // TRUE if first display has been performed
-  uint8_t gobbling; // # Clock ticks till we're fed (PM)
-  uint8_t inum;     // Instance serial number
-} entity;
-
-void
-dot_pacman(void) {
-  uint8_t seldir;   // PM's current moving direction
-
-  if (PACMAN_ADDR->gobbling) {
-    dot_pmgo();     // Display pacman as gobbling
-    PACMAN_ADDR->gobbling--;
-    return;
-  }
-
-  seldir = PACMAN_ADDR->cdir == dir_blocked ?
-    PACMAN_ADDR->pdir : PACMAN_ADDR->cdir;
-  switch (seldir) {
-    case dir_right:
-      dot_pmrgt();
-      return;
-    case dir_left:
-      dot_pmlft();
-      return;
-    case dir_up:
-      dot_pmupw();
-      return;
-    case dir_down:
-      dot_pmdnw();
-      return;
-  }
-
-  crash_and_burn("dot_pacman: invalid current direction");
-}
+// Shadow screen compositor. The maze area is composed from the
+// background layer (the glyphs of game_grid()) and the sprite layer.
+// The result is diffed against what the terminal is known to
+// display and only the differing columns are emitted.
 
+// Store grid character 'gc' at [row, pcol] in the target screen.
 void
-entity_display(entity *self) {
-  if (!self->inum) {
-    dot_pacman();
-    return;
-  }
-
-  if (fright_timer)
-    switch (self->inum) {
-      case 1:
-        dot_rblinky();
-        return;
-      case 2:
-        dot_rinky();
-        return;
-      case 3:
-        dot_rpinky();
-        return;
-      case 4:
-        dot_rclyde();
-        return;
-    }
-  else
-    switch (self->inum) {
-      case 1:
-        dot_blinky();
-        return;
-      case 2:
-        dot_inky();
-        return;
-      case 3:
-        dot_pinky();
-        return;
-      case 4:
-        dot_clyde();
-        return;
-    }
-
-  crash_and_burn("entity_display: unknown instance number");
-}
-
-uint32_t
-bitclear(uint32_t val, uint32_t bitno) {
-  return val & (~(1 << bitno));
-}
-
-uint32_t
-is_bitset(uint32_t val, uint32_t bitno) {
-  return val & (1 << bitno);
-}
-
-uint32_t
-to_grid_space(uint32_t pcol) {
-  return pcol >> 1;
-}
+screen_put(uint32_t row, uint32_t pcol, uint8_t gc) {
+  // Defensive programming.
+  if (!glyph_enc[gc][0])
+    crash_and_burn("screen_put: illegal character");
 
-// If moving horizontally, the resulting pcol must be
-// >= 2 and < 64.
-// TODO: does the parameter really need to be passed as a 32 bit value?
-uint8_t
-is_valid_pcol(uint32_t pcol) {
-  return pcol >=2 && pcol < 64;
+  memcpy(&scr_tgt[row][pcol], glyph_enc[gc], 2);
 }
 
-// If moving vertically, the resulting vrow number must be
-// >= 2 and < 44.
-// TODO: does the parameter really need to be passed as a 32 bit value?
-uint8_t
-is_valid_vrow(uint32_t vrow) {
-  return vrow >=2 && vrow < 44;
+void
+screen_put_sprite(const sprite_t *sp) {
+  if (sp->glyph)
+    screen_put(sp->vrown >> 1, sp->pcoln, sp->glyph);
 }
 
-uint8_t
-is_scorable(uint8_t uchar) {
-  return uchar == cross || uchar == pellet;
-}
+// Compose the target screen. Sprites are painted in ent[]
+// order, except for 'topmost' which goes last.
+void
+screen_compose(const sprite_t *sp, uint32_t topmost) {
+  uint8_t grid[GRIDSIZE];
+  uint32_t row, col, i;
 
-uint8_t
-is_erasable(uint8_t uchar) {
-  return uchar == ' ' || is_scorable(uchar);
-}
+  game_grid(&game, grid);
+  for (row = 0; row < NROW; row++)
+    for (col = 0; col < NCOL; col++)
+      screen_put(row, col << 1, grid[row * NCOL + col]);
 
-uint8_t
-is_erasable_or_door(uint8_t uchar) {
-  return uchar == door || is_erasable(uchar);
+  for (i = 0; i < NENTITY; i++)
+    if (i != topmost)
+      screen_put_sprite(&sp[i]);
+  screen_put_sprite(&sp[topmost]);
 }
 
-uint8_t
-in_ghosts_pen(entity *self) {
-  uint8_t vrow = self->vrown,
-    pcol = self->pcoln;
-
-  return vrow >= 16 && vrow < 23 &&
-    pcol >= 30 && pcol < 35;
-}
+// Emit what differs between the target and current screens.
+// A gap of one or two unchanged columns is re-emitted, which is
+// cheaper than any cursor motion.
+void
+screen_update(void) {
+  uint32_t row, col, gap;
 
-// pcol and vrow are supposed to have been previously validated.
-uint8_t *
-get_grid_char_addr(uint8_t pcol, uint8_t vrow) {
-  return grid + (NCOL * to_grid_space(vrow)) + to_grid_space(pcol);
-}
+  custom_charset_select();
 
-// Returns the grid character at [vrow, pcol].
-uint8_t
-get_grid_char(uint8_t pcol, uint8_t vrow) {
-  // Enforce assumptions.
-  if (!is_valid_vrow(vrow))
-    crash_and_burn("get_grid_char: vrow is out of bounds");
-  if (!is_valid_pcol(pcol))
-    crash_and_burn("get_grid_char: pcol is out of bounds");
+  for (row = 0; row < NROW; row++)
+    for (col = 0; col < NPCOL; col++) {
+      if (scr_tgt[row][col] == scr_cur[row][col])
+        continue;
+
+      gap = X0 + col - cur_x;
+      if (cur_y == (int32_t)row && !gap)
+        ;                                // Already there
+      else if (cur_y == (int32_t)row && cur_x >= X0 &&
+        cur_x < (int32_t)(X0 + col) && gap <= 2) {
+        ob_text(&scr_cur[row][cur_x - X0], gap);
+        cm_saved += 4 + ndigits(1 + row) + ndigits(1 + X0 + col) - gap;
+      }
+      else
+        at_xy(X0 + col, row);
 
-  return *get_grid_char_addr(pcol, vrow);
+      scr_cur[row][col] = scr_tgt[row][col];
+      ob_text(&scr_cur[row][col], 1);
+    }
 }
 
-// Note: ghost_dirselect() guarantees us that both pcoln and
-// vrown are even. TODO: what about PM's moving policy???
-uint8_t
-can_move_in_dir(entity *self, uint8_t dir) {
-  uint8_t vrow = self->vrown,
-    pcol = self->pcoln,
-    grid_char;
-
-  switch (dir) {
-    case dir_left:
-      if (!is_valid_pcol(pcol -= 2))
-        return 0;
-      break;
-    case dir_right:
-      if (!is_valid_pcol(pcol += 2))
-        return 0;
-      break;
-    case dir_up:
-      if (!is_valid_vrow(vrow -= 2))
-        return 0;
-      break;
-    case dir_down:
-      if (!is_valid_vrow(vrow += 2))
-        return 0;
-      break;
-    default:
-      crash_and_burn("can_move_in_dir: invalid dir");
-  }
-
-  grid_char = get_grid_char(pcol, vrow);
-  // The grid character might not be considered as an
-  // erasable and still may be if:
-  // 1: the grid character is 'T' (ghosts' pen door) AND
-  // 2: we're a ghost (i.e. not pacman) AND
-  // 3: the originating coordinates are inside the ghosts'
-  //    pen.
-  // In essence, the ghosts' pen door _is_ an erasable but
-  // only for the ghosts when they are inside of the pen.
-  return is_erasable(grid_char) || // Still need to check for walls!!!
-    ((grid_char == door) &&        // Ghosts' pen door
-      (self->inum != 0) &&         // We are not pacman
-      in_ghosts_pen(self));
-}
-
-// Re-display an erasable that was at least partially obscured
-// by a ghost passing by.
-void
-dot_interfering(entity *self) {
-  if (!self->igchr)
-    return;
+// Set when what the terminal displays is no longer known, e.g.
+// after a frame has been dropped. The next frame is a full repaint.
+uint32_t scr_repaint = 0;
 
-  at_xy(X0 + self->ipcoln, to_grid_space(self->ivrown));
-  dot_grid_char(self->igchr);
+void
+screen_lost(void) {
+  scr_repaint = 1;
+  cursor_lost();
+  term_lost();
 }
 
-// Utility routine--not a method.
+// Paint a whole frame from the given sprites.
 void
-entity_reset_coords_and_dir(entity *self) {
-  self->cdir = self->dir0;
-  self->vrown = self->vrow0;
-  self->pcoln = self->pcol0;
+screen_render_sprites(const sprite_t *sp, uint32_t topmost) {
+  if (scr_repaint) {
+    scr_repaint = 0;
+    page();
+    dot_init_sitrep();
+  }
+  status_render();
+  screen_compose(sp, topmost);
+  screen_update();
 }
 
+// Paint a whole frame. The terminal catches up with the game.
 void
-pacman_dying_routine(void) {
-  uint8_t i, j;
-  uint8_t prow = to_grid_space(PACMAN_ADDR->vrown),
-    pcol = X0 + PACMAN_ADDR->pcoln;
+screen_render(uint32_t topmost) {
+  sprite_t sp[NENTITY];
   entity *ep;
+  uint32_t i;
 
-  for (i = 0; i < 4; i++)   // 4 self rotations
-    for (j = dir_up; j < dir_blocked; j++) {
-       PACMAN_ADDR->cdir = j;
-       at_xy(pcol, prow);
-       dot_pacman();
-       ms(125);
-    }
-  at_xy(pcol, prow);
-  dot_grid_char(' ');
-
-  fright_timer = 0;         // PM no longer "supercharged"
-  PACMAN_ADDR->reward = 0;  // Reset the 'reward' field
-
-  // Every entity returned to its original upright position.
   for (i = 0; i < NENTITY; i++) {
-    ep = (entity *)entvec[i];
-
-    // Blank current entity location.
-    at_xy(X0 + ep->pcoln, to_grid_space(ep->vrown));
-    dot_grid_char(' ');
-
-    if (i) {
-      // Restore potentially obscured character.
-      dot_interfering(ep);
-
-      // Also clear the possible interference record.
-      ep->igchr = 0;
-
-      // Keep the ghosts mostly harmless for a little time.
-      ep->resurr = 20;
-    }
-
-    // Generic death handling.
-    entity_reset_coords_and_dir(ep);
-    ep->inited = 0;
+    ep = &game.ent[i];
+    sp[i].vrown = ep->vrown;
+    sp[i].pcoln = ep->pcoln;
+    sp[i].glyph = ep->glyph;
   }
+  screen_render_sprites(sp, topmost);
 }
 
-// TODO: omitted debugging support code.
-
-dir_t
-keyboard_input_query(void) {
-  uint8_t inp;
-
-  if(!key_question())
-    return dir_unspec;       // No input at this time
-
-  inp = key();
-  if (inp == 'q')
-    return dir_quit;
-  if (inp != '\x1B')
-    return dir_unspec;
+// PM's dying animation: 4 self rotations, everybody else frozen
+// where they were. The game itself has moved on already.
+void
+death_play(const evlist_t *el) {
+  sprite_t sp[NENTITY];
+  uint32_t i;
 
-  if (key() != '[')
-    return dir_unspec;
+  memcpy(sp, el->death_sprite, sizeof(sp));
+  for (i = 0; i < NDEATHFRAME; i++) {
+    sp[0].glyph = el->death_glyph[i];
+    screen_render_sprites(sp, 0); // PM stays on top of everything
+    frame_end();
+    ms(125);
+  }
+  tick_resync();                  // That took a while
+}
 
-  // CSI has been parsed, so far.
-  switch (key()) {
+// ------------------------------------------------------------
+// Keyboard input. Whatever is pending is read in one go and fed
+// to an incremental parser, so that a lone ESC or a partial
+// control sequence never blocks the game. Arrow keys are
+// recognized in both their CSI ("ESC [ A") and SS3 ("ESC O A",
+// application cursor mode) forms. Only the last one pressed
+// matters: it becomes PM's intended direction.
+
+#define IBUFSIZE 64
+#define ESC_TIMEOUT 250          // Milliseconds. Then ESC was a key
+
+typedef enum kbdstate_t {
+  kbd_ground,
+  kbd_esc,                       // ESC seen
+  kbd_csi,                       // ESC [ seen
+  kbd_ss3                        // ESC O seen
+} kbdstate_t;
+
+kbdstate_t kbd_state = kbd_ground;
+struct timespec kbd_esc_time;    // When the ESC was received
+uint32_t kbd_nparam;             // # CSI parameter bytes
+uint32_t kbd_param;              // Value of the first CSI parameter
+uint8_t kbd_dir = dir_unspec;    // Last arrow key, for the next step
+
+// Cursor key final character to direction.
+void
+kbd_arrow(uint8_t c) {
+  switch (c) {
     case 'A':
-      return dir_up;
+      kbd_dir = dir_up;
+      break;
     case 'B':
-      return dir_down;
+      kbd_dir = dir_down;
+      break;
     case 'C':
-      return dir_right;
+      kbd_dir = dir_right;
+      break;
     case 'D':
-      return dir_left;
-  }
-
-  return dir_unspec;     // No comprendo
-}
-
-uint8_t
-is_pacman_stepped_on(entity *ghost) {
-  uint8_t pm_grow, pm_gcol;
-
-  if (!ghost->inum)      // This cannot be applied to PM itself!!!
-    crash_and_burn("is_pacman_stepped_on: applied to PM");
-
-  pm_grow = to_grid_space(PACMAN_ADDR->vrown);
-  pm_gcol = to_grid_space(PACMAN_ADDR->pcoln);
-  return (pm_grow == to_grid_space(ghost->vrown)) &&
-    (pm_gcol == to_grid_space(ghost->pcoln));
-}
-
-dir_t
-pacman_dirselect(entity *self) {
-  uint8_t dir;
-  dir_t rv;
-
-  // Keyboard input overrides any previous intended direction.
-  dir = keyboard_input_query();
-  if (dir != dir_unspec) {
-    if (dir == dir_quit)
-      crash_and_burn("pacman_dirselect: Exiting game");
-
-    // If a direction change is requested via keyboard input:
-    // mark it as the intended direction (idir) and proceed.
-    if (dir < dir_blocked)
-      self->idir = dir; 
-  }
-
-  // No direction changes unless both vrow# and pcol# are even.
-  if ((self->vrown & 1) || (self->pcoln & 1))
-    return (dir_t)(self->cdir);
-
-  // If idir is not dir_unspec AND we can move in idir:
-  // - queue up idir as the return value.
-  // - reset idir to dir_unspec.
-  // - end of story.
-  if (self->idir != dir_unspec &&
-    can_move_in_dir(self, self->idir)) {
-      rv = (dir_t)(self->idir);
-      self->idir = dir_unspec;
-      return rv;
-  }
-
-  // Default policy: keep the current direction unless blocked.
-  if (self->cdir == dir_blocked)
-    return dir_blocked;
-
-  if (can_move_in_dir(self, self->cdir))
-    return (dir_t)(self->cdir);
-
-  self->pdir = self->cdir;
-  return dir_blocked;
-}
-
-// This is a tricky one since the original Forth code returns
-// FALSE|dir\TRUE, i.e. a variable outcome. We can't have that
-// kind of flexibility in C.
-int8_t
-only_one_dir(uint32_t bm) {
-  switch (bm) {
-    case 1:
-      return 0;
-    case 2:
-      return 1;
-    case 4:
-      return 2;
-    case 8:
-      return 3;
-  }
-
-  return -1;     // For the lack of a better alternative...
+      kbd_dir = dir_left;
+      break;
+  }                              // No comprendo
 }
 
-// The following implements the frightened ghost mode.
-// 'bitmap' has the superposition of viable alternatives, in terms
-// of possible directions for a ghost.
-dir_t
-ghost_dirselect_fright(entity *ep, uint32_t bitmap) {
-  uint8_t bit0;
-  dir_t dir;
-
-  (void)ep;           // The parameter is passed and ignored. So it goes...
-
-  for (dir = dir_up; dir < dir_blocked; dir++) {
-    bit0 = bitmap & 1;
-    bitmap >>= 1;
-    if (bit0) {       // dir is an option
-      if (bitmap) {   // There are other possible directions
-        if (prandom() & 8)
-          return dir; // Select direction 'dir'
+void
+kbd_feed(uint8_t c) {
+  switch (kbd_state) {
+    case kbd_ground:
+      if (c == '\x1B') {
+        kbd_state = kbd_esc;
+        (void)clock_gettime(CLOCK_MONOTONIC, &kbd_esc_time);
       }
-      else            // There are no alternatives left
-        return dir;
-    }
-  }
+      else if (c == 'q')
+        crash_and_burn("keyboard_input_process: Exiting game");
+      return;
 
-  crash_and_burn("ghost_dirselect_fright: no viable direction found");
-
-  // Avoid useless compiler warning.
-  return dir_down;
-}
-
-// For every bit set in bitmap, we need to evaluate the
-// Euclidian distance between the potential next location and
-// the target tile. Finally we return the direction that
-// minimizes the distance.
-dir_t
-ghost_dirselect_nav2target(entity *self, uint32_t bitmap, int8_t tvr,
-  int8_t tpc) {
-  int8_t pcol, vrow;
-  uint16_t minval = 65535, minnew;
-  int16_t dx, dy;
-  dir_t dir, dirmin = (dir_t)-1;
-
-  for (dir = dir_up; dir < dir_blocked; dir++) {
-    if (is_bitset(bitmap, dir)) {
-      pcol = (int8_t)self->pcoln;
-      vrow = (int8_t)self->vrown;
-
-      // Need to project into the next potential coordinates (in virtual space).
-      switch (dir) {
-        case dir_left:
-          pcol--;
-          break;
-        case dir_right:
-          pcol++;
-          break;
-        case dir_up:
-          vrow--;
-          break;
-        case dir_down:
-          vrow++;
-          break;
-        default:
-          crash_and_burn("ghost_dirselect_nav2target: unrecognized current "
-            "direction");
+    case kbd_esc:
+      if (c == '[') {
+        kbd_state = kbd_csi;
+        kbd_nparam = kbd_param = 0;
       }
-
-      // We compare the distance to the target squared.
-      dx = ((int16_t)pcol) - ((int16_t)tpc);
-      dy = ((int16_t)vrow) - ((int16_t)tvr);
-      minnew = dx * dx + dy * dy;
-      if (minnew < minval) {
-        dirmin = dir;
-        minval = minnew;
+      else if (c == 'O')
+        kbd_state = kbd_ss3;
+      else {                     // That ESC was a key on its own
+        kbd_state = kbd_ground;
+        kbd_feed(c);
       }
-    }
-  }
-
-  if (dirmin == (dir_t)-1)
-    crash_and_burn("ghost_dirselect_nav2target: no minimum found");
-
-  return dirmin;
-}
-
-// In scatter mode, simply navigate to the ghost home corner.
-dir_t
-ghost_dirselect_scatter(entity *self, uint32_t bitmap) {
-  return ghost_dirselect_nav2target(self, bitmap, self->hcvrn, self->hcpcn);
-}
-
-dir_t
-ghost_dirselect_chase(entity *self, uint32_t bitmap) {
-  int8_t pcol, vrow;
-  entity *bp;
-  dir_t dir;
-
-  // Blinky handling. The target is PM's current location.
-  if (self->inum == 1)
-    return ghost_dirselect_nav2target(self, bitmap, PACMAN_ADDR->vrown,
-      PACMAN_ADDR->pcoln);
-
-  // Pinky handling. The target is 8 half tiles in PM's
-  // current moving direction. It might be off the grid but
-  // that does not matter in the least.
-  if (self->inum == 2) {
-    // Project PM's future location based on its current direction
-    // by 8 tiles in virtual space.
-    vrow = (int8_t)PACMAN_ADDR->vrown;
-    pcol = (int8_t)PACMAN_ADDR->pcoln;
-
-
-    // PM maybe blocked. If it is, act on 'pdir' instead of 'cdir'.
-    dir = PACMAN_ADDR->cdir != dir_blocked ?
-      PACMAN_ADDR->cdir : PACMAN_ADDR->pdir;
-    switch (dir) {
-      case dir_left:
-        pcol -= 8;
-        break;
-      case dir_right:
-        pcol += 8;
-        break;
-      case dir_up:
-        vrow -= 8;
-        break;
-      case dir_down:
-        vrow += 8;
-        break;
-      default:
-        crash_and_burn("ghost_dirselect_chase: PM's current direction "
-          "not recognized (Pinky)");
-    }
-    return ghost_dirselect_nav2target(self, bitmap, vrow, pcol);
-  }
-
-  // Inky handling. The target is at the end of a vector twice
-  // as long as the one originating from Blinky to PM's moving
-  // direction extrapolated by 4 half tiles.
-  if (self->inum == 3) {
-    vrow = (int8_t)PACMAN_ADDR->vrown;
-    pcol = (int8_t)PACMAN_ADDR->pcoln;
-
-    // PM maybe blocked. If it is, act on 'pdir' instead of 'cdir'.
-    dir = PACMAN_ADDR->cdir != dir_blocked ?
-      PACMAN_ADDR->cdir : PACMAN_ADDR->pdir;
-    switch (dir) {
-      case dir_left:
-        pcol -= 4;
-        break;
-      case dir_right:
-        pcol += 4;
-        break;
-      case dir_up:
-        vrow -= 4;
-        break;
-      case dir_down:
-        vrow += 4;
-        break;
-      default:
-        crash_and_burn("ghost_dirselect_chase: PM's current direction "
-          "not recognized (Inky)");
-    }
-
-    // For the record, Blinky is entity #1 in entvec.
-    bp = (entity *)(entvec[1]);
-    vrow = 2 * (vrow - bp->vrown);  // This is a delta on Y 
-    pcol = 2 * (pcol - bp->pcoln);  // This is a delta on X 
+      return;
 
-    // The relative displacement refers to Blinky's current pos.
-    return ghost_dirselect_nav2target(self, bitmap,
-      bp->vrown + vrow, bp->pcoln + pcol);
-  }
+    case kbd_csi:
+      if (c >= 0x30 && c <= 0x3F) {  // Parameter byte
+        if (c >= '0' && c <= '9' && kbd_param < 1000)
+          kbd_param = 10 * kbd_param + c - '0';
+        kbd_nparam++;
+        return;
+      }
+      if (c >= 0x20 && c <= 0x2F)    // Intermediate byte
+        return;
 
-  // Default policy. Will only apply to Clyde--permanently
-  // frightened in chase mode.
-  return ghost_dirselect_fright(self, bitmap);
-}
+      kbd_state = kbd_ground;
+      if (c == 'n' && kbd_nparam)    // DSR reply
+        dsr_reply(kbd_param);
+      else if (c >= 0x40 && c <= 0x7E && !kbd_nparam)
+        kbd_arrow(c);
+      return;
 
-// From the "pacman dossier:"
-// "Ghosts are forced to reverse direction by the system anytime
-// the mode changes from: chase-to-scatter, chase-to-frightened,
-// scatter-to-chase, and scatter-to-frightened. Ghosts do not
-// reverse direction when changing back from frightened to chase
-// or scatter modes."
-//
-// Interpreting the gospel:
-// - 'reversing direction' means selecting opposite(cdir).
-//
-// The direction returned is guaranteed to be adopted by the
-// caller.
-dir_t
-ghost_dirselect(entity *self) {
-  uint8_t bitmap = 0X0F;     // The sum of 'a priori' alternatives
-  uint8_t revreq = self->revflg;
-  dir_t dir;
-
-  // No direction changes unless both vrow# and pcol# are even.
-  if ((self->vrown & 1) || (self->pcoln & 1))
-    return (dir_t)(self->cdir);
-
-  if (revreq)               // Direction reversal is requested
-    self->revflg = 0;
-  else                      // Exclude opposite(cdir)
-    bitmap = bitclear(bitmap, (self->cdir + 2) & 3);
-
-  // Ascertain which directions are possible.
-  for (dir = dir_up; dir < dir_blocked; dir++)
-    if (is_bitset(bitmap, dir) &&
-      !can_move_in_dir(self, dir))
-      bitmap = bitclear(bitmap, dir);
-
-  // If we are inside of the ghosts' pen and the current
-  // direction remains open, ignore revflg and stick to that.
-  if (in_ghosts_pen(self) && is_bitset(bitmap, self->cdir))
-    return (dir_t)(self->cdir);
-
-  // Honor direction reversal requests.
-  if (revreq)
-    return (dir_t)((self->cdir + 2) & 3);
-
-  // Optimization: if bitmap is a power of two--only one
-  // direction is viable--return this direction immediately.
-  if ((dir = only_one_dir(bitmap)) != (int8_t)-1)
-    return dir;
-
-  // Ghost mode dependent behaviour.
-  switch (gm_cur) {
-    case mode_fright:
-      return ghost_dirselect_fright(self, bitmap);
-    case mode_scatter:
-      return ghost_dirselect_scatter(self, bitmap);
-    case mode_chase:
-      return ghost_dirselect_chase(self, bitmap);
+    case kbd_ss3:
+      kbd_state = kbd_ground;
+      kbd_arrow(c);
+      return;
   }
-
-  crash_and_burn("ghost_dirselect: unsupported ghost mode");
-
-  // Avoid useless compiler warning.
-  return dir_down;
 }
 
-// Utility routine--not a method.
+// Give up on an incomplete sequence after ESC_TIMEOUT.
 void
-entity_initial_display(entity *self) {
-  at_xy(X0 + self->pcoln, to_grid_space(self->vrown));
-  self->display(self);
-}
+kbd_timeout(void) {
+  struct timespec now;
 
-// Utility routine--not a method.
-void
-entity_get_new_coordinates(entity *self, uint8_t *pcnew, uint8_t *vrnew) {
-  *pcnew = self->pcoln;
-  *vrnew = self->vrown;
-
-  // Handling a resurrecting/grounded ghost.
-  if (self->resurr) {
-    self->resurr--;
+  if (kbd_state == kbd_ground)
     return;
-  }
 
-  switch (self->cdir) {
-    case dir_left:
-      (*pcnew)--;
-      break;
-    case dir_right:
-      (*pcnew)++;
-      break;
-    case dir_up:
-      (*vrnew)--;
-      break;
-    case dir_down:
-      (*vrnew)++;
-      break;
-    // dir_blocked (PM only): fall through.
-  }
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  if (ts_diff_us(&now, &kbd_esc_time) >= ESC_TIMEOUT * 1000)
+    kbd_state = kbd_ground;
 }
 
-// Utility routine--not a method.
-// Do not preserve erasables. Manage gobbling aspect. This
-// requires an update to 'grid'. Update the score accordingly.
+// Consume all pending keyboard input. This is called while we
+// wait for the end of the clock cycle, so that the next one sees
+// the latest intended direction. This never blocks.
 void
-pacman_moving_policy(entity *self, uint8_t pcnew, uint8_t vrnew) {
-  uint8_t gc;
-
-  // No change unless both 'pcnew' and 'vrnew' both are even.
-  if ((pcnew & 1) || (vrnew & 1))
-    return;
-
-  // Return immediately unless we have just consumed a cross or a pellet.
-  if (!is_scorable(gc = get_grid_char(pcnew, vrnew)))
-    return;
+keyboard_input_process(void) {
+  uint8_t buf[IBUFSIZE];
+  ssize_t i, n;
 
-  self->gobbling = 2;    // Gobble for two clock cycles
+  kbd_timeout();
+  while (key_question()) {
+    // Bypass curses for all terminal I/Os.
+    if ((n = read(fileno(stdin), buf, sizeof(buf))) == 0)
+      crash_and_burn("keyboard_input_process: end of input");
+    if (n == -1)
+      return;                    // EINTR/EAGAIN. Next time then
 
-  switch (gc) {
-    case cross:
-      update_score(10);
-      break;
-    case pellet:
-      update_score(50);
-      // Enter "supercharged" mode
-      // Note: we do not reset the 'reward' field here.
-      // Maybe we should--or not. This is a possible way
-      // to achieve wicked scores!!!
-      super_enter();
-      break;
+    for (i = 0; i < n; i++)
+      kbd_feed(buf[i]);
   }
-
-  // Cross or pellet consumed. Blank the grid character.
-  *get_grid_char_addr(pcnew, vrnew) = (uint8_t)' ';
-
-  if (nremitem)
-    nremitem--;
 }
 
-// Utility routine--not a method.
-// Preserve erasables.
-void
-ghost_moving_policy(entity *self, uint8_t pcnew, uint8_t vrnew) {
-  uint8_t gc;
-
-  // Check whether we previously saved an interfering character.
-  // If so, re-display it at the saved coordinates.
-  dot_interfering(self);
-
-  // Defer the "save-under" logic until pcnew is even.
-  if (pcnew & 1)
-    return;
-
-  // Are we stepping on anyone's toes (interfering)?
-  // Note: interference is checked at the new coordinates.
-  gc = get_grid_char(pcnew, vrnew);
-
-  // A non-BL erasable character is said to be interfering.
-  if ((gc != (uint8_t)' ') &&
-    is_erasable_or_door(gc)) {
-    if (self->igchr) {         // Did we already know about it?
-      // Yes. Check for a new interference.
-      if (self->igchr != gc) { // Interfering differently
-        dot_interfering(self);
-        self->igchr = gc;
-        // Force even row#, wrt. interfering coordinates. TODO: legit?
-        self->ivrown = vrnew & ~1;
-        self->ipcoln = pcnew;
-      }
-      return;
-    }
+// ------------------------------------------------------------
+// Input logs (-i, -p). What game_step() is handed is recorded,
+// so that the session can be replayed exactly. See pmrec.h. In
+// playback, arrow keys are ignored but 'q' still quits.
 
-    // No, register interference details
-    self->igchr = gc;
-    // Force even row#, wrt. interfering coordinates. TODO: legit?
-    self->ivrown = vrnew & ~1;
-    self->ipcoln = pcnew;
-    return;
-  }
+#ifdef VT420
+#define REC_VARIANT rec_vt420
+#define REC_BUILD "pm420 " __DATE__ " " __TIME__
+#else
+#define REC_VARIANT rec_vt340
+#define REC_BUILD "pm340 " __DATE__ " " __TIME__
+#endif
 
-  dot_interfering(self);     // TODO: legit?
-  self->igchr = 0;           // Clear interference record
-}
+rec_t *inlog = NULL;             // Recording in progress, if any
+replay_t replay;
+recpos_t replay_pos;
+uint32_t replay_on = 0;
+uint32_t stepping = 0;           // TRUE while in game_step()
 
-// Utility routine--not a method.
 void
-collision_handle(entity *ghost_addr, uint8_t *pcol, uint8_t *vrow,
-  uint8_t onproc) {
-
-  // Defensive programming: make sure the entity at '*ghost_addr' is a ghost.
-  if (((ghost_addr->inum < 1) || (ghost_addr->inum >= NENTITY)))
-    crash_and_burn("collision-handle: not a ghost at '*ghost_addr'");
-
-  if (fright_timer) {
-    // The ghost at 'ghost_addr' dies--unless it is resurrecting.
-    // Note: only Blinky resurrects outside of the pen.
-    if (!ghost_addr->resurr) {
-      dot_interfering(ghost_addr);
-      ghost_addr->igchr = 0;   // Clear interference record
-
-      ghost_addr->resurr = 50; // Ghost grounded for 50 clk cycles
-
-      // Update the score based on PM's 'reward' field.
-      if (PACMAN_ADDR->reward)
-        PACMAN_ADDR->reward *= 2;
-      else
-        PACMAN_ADDR->reward = 2;
-      update_score(100 * ((uint32_t)PACMAN_ADDR->reward));
-
-      entity_reset_coords_and_dir(ghost_addr);
-
-      // Ghost returned to the pen.
-      if (onproc) {            // If the ghost just killed was ONPROC
-        // Replace anticipated coordinates with the updated ones.
-        *pcol = ghost_addr->pcoln;
-        *vrow = ghost_addr->vrown;
-      }
-    }
-    return;                    // We're done here
+inlog_open(void) {
+  if (opt_replay) {
+    replay_load(opt_replay, &replay, opt_ai);
+    replay_rewind(&replay, &replay_pos);
+    replay_on = 1;
   }
-
-  // PM dies
-  pacman_dying_routine();
-  update_lives();
-
-  if (!lives)
-    crash_and_burn("collision_handle: game over!");
-
-  // If 'onproc' is zero, PM was ONPROC and we need to update
-  // *pcol/*vrow to match PM's post mortem coordinates.
-  if (!onproc) {
-    *pcol = PACMAN_ADDR->pcoln;
-    *vrow = PACMAN_ADDR->vrown;
-    return;                    // We're done here
-  }
-
-  // A ghost is ONPROC and is responsible for PM's death.
-  *pcol = ghost_addr->pcoln;
-  *vrow = ghost_addr->vrown;
+  if (opt_inlog)
+    inlog = rec_create(opt_inlog, REC_VARIANT, REC_BUILD, opt_kfint,
+      opt_ai);
 }
 
-// Entity method.
+// On the way out. If a signal interrupted game_step(), the last
+// step does not count and the state is not worth a digest.
 void
-entity_move(entity *self) {
-  uint8_t pcnew, vrnew;
-  int i;
-  entity *ghost_addr = NULL;
+inlog_close(void) {
+  rec_t *rp = inlog;
 
-  if (!self->inited) {
-    entity_initial_display(self);
-    self->inited = 1;
+  if (!rp)
     return;
-  }
-
-  // 'cdir' validation.
-  if (self->cdir > dir_blocked)
-    crash_and_burn("entity_move: illegal current direction");
-
-  // dir_blocked should only be in effect for PM, which
-  // is an indication that some keyboard input is required.
-  if ((self->cdir == dir_blocked) && (self->inum != 0))
-    crash_and_burn("entity_move: ghost blocked!!!");
-
-  self->cdir = self->inum ? ghost_dirselect(self) : pacman_dirselect(self);
-
-  // Blank current position on screen.
-  at_xy(X0 + self->pcoln, to_grid_space(self->vrown));
-  dot_grid_char(' ');
-
-  // Retrieve projected coordinates.
-  entity_get_new_coordinates(self, &pcnew, &vrnew);
-
-  if (self->inum)
-    ghost_moving_policy(self, pcnew, vrnew);
-  else
-    pacman_moving_policy(self, pcnew, vrnew);
-
-  // Update entity's coordinates fields.
-  self->pcoln = pcnew;
-  self->vrown = vrnew;
-
-  // Collision handling.
-  if (self->inum           // A ghost is ONPROC
-    && is_pacman_stepped_on(self))
-    ghost_addr = self;
-  else {                   // PM is ONPROC
-    // We have to check all possible ghosts' coordinates.
-    for (i = 1; i < NENTITY; i++)
-      if (is_pacman_stepped_on((entity *)(entvec[i]))) {
-        ghost_addr = (entity *)(entvec[i]);
-        break;
-      }
-  }
-
-  // TODO: the following is kinda dubious...
-  if (ghost_addr)
-    collision_handle(ghost_addr, &pcnew, &vrnew, ghost_addr == self);
-
-  // Display entity at new coordinates.
-  at_xy(X0 + pcnew, to_grid_space(vrnew));
-  entity_display(self);
-}
-
-uint32_t
-serialno_getnext(void) {
-  return serialno++;
-}
-
-// Entity constructor.
-void *
-entity_new(uint8_t hcvr, uint8_t hcpc, uint8_t vrow, uint8_t pcol,
-  uint8_t cdir) {
-  entity *ep;
-
-  if (!(ep = calloc(sizeof(entity), 1)))
-    crash_and_burn("entity_new: calloc returned NULL");
-
-  // Initialize default valued fields.
-  ep->strategy = (method)entity_move;
-  ep->display = (method)entity_display;
-  ep->pdir = dir_blocked;
-  ep->idir = dir_unspec;
-
-  // Initialize fields from arguments.
-  ep->cdir = ep->dir0 = cdir;
-  ep->pcoln = ep->pcol0 = pcol;
-  ep->vrown = ep->vrow0 = vrow;
-  ep->hcvrn = hcvr;
-  ep->hcpcn = hcpc;
-
-  // Intrinsics.
-  ep->inum = serialno_getnext();
-  return (void *)ep;
-}
-
-// -------------------------------------------------------------
-// Ghost mode logic is time based but there's more to it than
-// just time. When PM becomes "supercharged" the ghosts
-// transition to the frightened state for some time.
-
-uint32_t gm_seqno;
-uint32_t gm_timer;
-
-int32_t gm_sched[][3] = {
-  //              L1      L2-4    L5+     seqno
-  /* Scatter */ { 7,      7,      5    }, // 0
-  /* Chase   */ { 20,     20,     20   }, // 1
-  /* Scatter */ { 7,      7,      5    }, // 2
-  /* Chase   */ { 20,     20,     20   }, // 3
-  /* Scatter */ { 5,      5,      5    }, // 4
-  /* Chase   */ { 20,     1033,   1037 }, // 5
-  /* Scatter */ { 5,      1,      1    }, // 6
-  /* Chase   */ { -1,     -1,     -1   }  // 6+ -> forever
-};
-
-// Returns a clock cycle count.
-// TODO: this code should be under scrutiny.
-int32_t
-gm_timer_initval_get(uint8_t level, uint8_t seqno) {
-  int32_t clk_cycles;
-  int offset;
-
-  // Defensive programming--enforce assumptions.
-  if (!level)
-    crash_and_burn("gm_timer_initval_get: level is zero");
-  // TODO: seqno should also be checked for consistency.
-
-  if (level == 1)
-    offset = 0;
-  else
-    offset = level < 5 ? 1 : 2;
-
-  clk_cycles = gm_sched[seqno][offset];
-  if (clk_cycles == -1)
-    return clk_cycles;
-
-  return (clk_cycles * 1000) / CLKPERIOD;
+  inlog = NULL;                  // In case rec_close() crashes and burns
+  rec_close(rp, stepping ? game.tick - 1 : game.tick,
+    stepping ? NULL : &game);
 }
 
+// PM's intended direction for the next step.
 uint8_t
-gm_seqno_getnext(void) {
-  // The sequence number is capped at 7.
-  return gm_seqno < 6 ? 1 + gm_seqno : 7;
-}
-
-// Called after a context change (sequence number or game level).
-ghostmode_t
-gm_getnext(void) {
-  int32_t ncycles;
-
-  // Debugging code begins.
-  // gm_timer_en = 0;
-  // return mode_chase;
-  // Debugging code ends.
-
-  gm_timer_en = ncycles = gm_timer_initval_get(gamlev, gm_seqno);
-  if (ncycles != (int32_t)-1) {
-    gm_timer = ncycles;
-    return gm_seqno & 1 ? mode_chase : mode_scatter;
-  } 
-
-  return mode_chase;
-}
-
-void
-gm_prv_update(void) {
-  if (gm_cur == mode_fright)
-    return;
-  gm_prv = gm_cur;
-}
-
-// All ghosts adopt the direction opposite to the current one.
-void
-gm_allghosts_reverse(void) {
-  int i;
-
-  for (i = 1; i < NENTITY; i++)
-    ((entity *)entvec[i])->revflg = 1;
-  bell();
-}
-
-void
-gm_switchto(ghostmode_t mode) {
-  int i;
+input_next(void) {
+  uint8_t dir = kbd_dir;
 
-  if (mode == gm_cur)
-    return;             // Current mode is not changing
+  kbd_dir = dir_unspec;
+  if (replay_on)
+    dir = replay_input(&replay, &replay_pos, game.tick + 1);
 
-  // If switching away from chase or scatter modes, signal
-  // direction reversal request to all ghost instances.
-  if (gm_cur != mode_fright)
-    gm_allghosts_reverse();
-
-  gm_prv_update();
-  gm_cur = mode;
+  if (inlog && dir < dir_blocked)
+    rec_key(inlog, game.tick + 1, dir);
+  return dir;
 }
 
+// Stop where the recording did and tell whether we got to the
+// same state.
 void
-super_enter(void) {
-  gm_allghosts_reverse();           // HackerB9's request
-
-  // We might want to return immediately depending on 'gamlev'
-  if (gm_cur == mode_fright) {      // Already frightened
-    fright_timer = SUPER_CLKCYCLES; // Be kind, reset the timer!
+replay_check(void) {
+  if (!replay_on || !replay.ended || game.tick < replay.end_tick)
     return;
-  }
-
-  gm_prv_update();
-  gm_cur = mode_fright;
-  gm_timer_en = 0;                  // Suspend gm_timer
-  fright_timer = SUPER_CLKCYCLES;   // Enable the 'fright' timer
-}
 
-void
-super_leave(void) {
-  PACMAN_ADDR->reward = 0;          // Reset ghost kill counter
-  gm_switchto(gm_prv);
-  gm_timer_en = -1;                 // Re-enable gm_timer
+  if (!replay.end_hasdigest)
+    crash_and_burn("End of replay");
+  crash_and_burn(game_digest(&game) == replay.end_digest ?
+    "End of replay, same final state" : "End of replay, state differs!");
 }
 
 // -------------------------------------------------------------
-// Reset all entities coords/dir and set 'inited' to FALSE.
-// Also clear 'fright_timer' and PM's 'reward' field.
-// Reset the PRNG's seed to a fixed value, as per the gospel.
+// Entry point here.
 
+// Turn what the last clock cycle did into terminal output.
 void
-level_entry_inits(void) {
-  entity *ep;
-  int i;
-
-  entity_reset_coords_and_dir(PACMAN_ADDR);
-  PACMAN_ADDR->inited = 0;
-  PACMAN_ADDR->reward = 0;
-
-  for (i = 1; i < NENTITY; i++) {
-    ep = ((entity *)entvec[i]);
-    entity_reset_coords_and_dir(ep);
-    ep->inited = 0;
-  }
-
-  seed = 23741;
+ev_render(const evlist_t *el) {
+  uint32_t i;
 
-  // Ghost mode level entry initializations.
-  fright_timer = 0;
-  gm_seqno = 0;
-  gm_cur = gm_getnext();
-  gm_prv = mode_unspec;
+  for (i = 0; i < el->n; i++)
+    switch (el->ev[i]) {
+      case ev_score:
+        st_dirty |= 1 << st_score;
+        break;
+      case ev_lives:
+        st_dirty |= 1 << st_lives;
+        break;
+      case ev_level:
+        st_dirty |= 1 << st_level;
+        break;
+      case ev_suptim:
+        st_dirty |= 1 << st_suptim;
+        break;
+      case ev_bell:
+        bell();
+        break;
+      case ev_death:
+        death_play(el);
+        break;
+      case ev_gameover:
+        crash_and_burn("collision_handle: game over!");
+    }
 }
 
-// -------------------------------------------------------------
-// Entry point here.
-
 void
 _main(void) {
-  entity *ep;
-  int i;
+  const evlist_t *el;
 
   for (;;) {
-    if (!nremitem) {                // If nremitem is 0, start new level
-      dot_initial_grid();
-      update_level();
-      level_entry_inits();
-      tty_drain();
+    replay_check();
+    stepping = 1;
+    el = game_step(&game, input_next());
+    stepping = 0;
+    if (inlog)
+      rec_step(inlog, &game);
+    ev_render(el);
+
+    if (el->n && el->ev[0] == ev_level) { // New level
+      screen_render(NENTITY - 1);
+      frame_end();
+      dsr_request();                // Measure how late the terminal is
+      tick_resync();
       continue;
     }
 
-    // Ghost mode handling.
-    if (gm_cur == mode_fright) {
-      if (fright_timer) {           // Continue w/ frightened ghosts
-        fright_timer--;
-        update_suptim();
-      }
-      else
-        super_leave();
-    }
+    // With -c, this frame is skipped if the previous one has not
+    // drained yet. The simulation keeps its pace and the next
+    // frame carries all the changes, since the compositor diffs
+    // against what the terminal displays.
+    if (opt_coalesce && ob_pending())
+      nframe_coalesced++;
     else {
-      if (gm_timer_en) {
-        if (gm_timer)
-          gm_timer--;               // Ghost mode unchanged
-        else {
-          gm_seqno = gm_seqno_getnext();
-          gm_switchto(gm_getnext());
+      screen_render(NENTITY - 1);
+      frame_end();
+    }
+    if (opt_dsr && !(tick_n % opt_dsr))
+      dsr_request();
+    tick_wait();
+  }
+}
+
+// -------------------------------------------------------------
+// Microbenchmark (-b). The cost per maze cell of a CUP sequence
+// and a glyph, formatted on the fly (the way at_xy() and
+// dot_grid_char() used to do it) versus pre-encoded. Output goes
+// to obuf, which is discarded after every pass.
+
+#define BENCH_NPASS 20000
+
+double
+bench_now(void) {
+  struct timespec ts;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void
+enc_bench(void) {
+  uint32_t pass, row, col;
+  double t0, t_fmt, t_tab;
+  uint8_t gc, dw[2], grid[GRIDSIZE];
+  char buf[32];
+
+  enc_init();
+  game_init(&game);
+  (void)game_step(&game, dir_unspec); // Level entry: the maze
+  game_grid(&game, grid);
+
+  t0 = bench_now();
+  for (pass = 0; pass < BENCH_NPASS; pass++) {
+    for (row = 0; row < NROW; row++)
+      for (col = 0; col < NCOL; col++) {
+        ob_write(buf, sprintf(buf, "\x1B[%d;%dH", (int)(1 + row),
+          (int)(1 + X0 + 2 * col)));
+        if ((gc = grid[row * NCOL + col]) == ' ') {
+          ob_write("  ", 2);
+          continue;
         }
+        if (!(gc >= 'A' && gc <= '^'))
+          crash_and_burn("enc_bench: illegal character");
+        dw[0] = 0x21 + ((gc - 'A') << 1);
+        dw[1] = dw[0] + 1;
+        ob_write(dw, 2);
       }
-    }
+    oblen = 0;
+  }
+  t_fmt = bench_now() - t0;
+
+  t0 = bench_now();
+  for (pass = 0; pass < BENCH_NPASS; pass++) {
+    for (row = 0; row < NROW; row++)
+      for (col = 0; col < NCOL; col++) {
+        cm_cup(X0 + 2 * col, row);
+        gc = grid[row * NCOL + col];
+        if (!glyph_enc[gc][0])
+          crash_and_burn("enc_bench: illegal character");
+        ob_write(glyph_enc[gc], 2);
+      }
+    oblen = 0;
+  }
+  t_tab = bench_now() - t0;
 
-    // Regular entity scheduling.
-    for (i = 0; i < NENTITY; i++) {
-      ep = (entity *)entvec[i];
-      ep->strategy(ep);
-    }
+  printf("cells:        %u\n", (unsigned)(BENCH_NPASS * GRIDSIZE));
+  printf("formatted:    %.1f ns/cell\n", t_fmt / (BENCH_NPASS * GRIDSIZE));
+  printf("pre-encoded:  %.1f ns/cell\n", t_tab / (BENCH_NPASS * GRIDSIZE));
+  softfont_report(stdout);
+  exit(0);
+}
 
-    ms(CLKPERIOD);
-  }
+#ifdef OB_THREAD
+#define OB_THREAD_OPT "a"
+#else
+#define OB_THREAD_OPT ""
+#endif
+
+void
+usage(char *progname) {
+  fprintf(stderr, "usage: %s [-%sbcdfsw] [-e euclid|maze] [-i inlog] "
+    "[-k ncycles]\n  [-l ncycles] [-o csvfile] [-p inlog] [-r baud]\n",
+    progname, OB_THREAD_OPT);
+#ifdef OB_THREAD
+  fprintf(stderr, "  -a  asynchronous terminal output\n");
+#endif
+  fprintf(stderr, "  -b  run the output encoding microbenchmark\n");
+  fprintf(stderr, "  -c  skip frames while the line is busy\n");
+  fprintf(stderr, "  -d  drop missed clock cycles instead of catching up\n");
+  fprintf(stderr, "  -e  ghost AI: straight line or maze distance (euclid)\n");
+  fprintf(stderr, "  -f  upload the soft font even if it looks cached\n");
+  fprintf(stderr, "  -i  record the input log to 'inlog'\n");
+  fprintf(stderr, "  -k  keyframe the input log every 'ncycles' clock cycles "
+    "(500, 0: none)\n");
+  fprintf(stderr, "  -l  measure the terminal lag every 'ncycles' clock "
+    "cycles\n");
+  fprintf(stderr, "  -o  dump per frame wire statistics to 'csvfile' on "
+    "exit\n");
+  fprintf(stderr, "  -p  play back the input log 'inlog'\n");
+  fprintf(stderr, "  -r  line speed for transmit time estimates (9600)\n");
+  fprintf(stderr, "  -s  print output statistics on exit\n");
+  fprintf(stderr, "  -w  display wire statistics in the status panel\n");
+  exit(1);
 }
 
 int
-main() {
+main(int argc, char *argv[]) {
+  int c;
+
+  while ((c = getopt(argc, argv, OB_THREAD_OPT "bcde:fi:k:l:o:p:r:sw")) != -1)
+    switch (c) {
+      case 'a':
+        opt_async = 1;
+        break;
+      case 'b':
+        enc_bench();             // No return
+        break;
+      case 'c':
+        opt_coalesce = 1;
+        break;
+      case 'd':
+        opt_tickdrop = 1;
+        break;
+      case 'e':
+        if (!strcmp(optarg, "euclid"))
+          opt_ai = ai_euclid;
+        else if (!strcmp(optarg, "maze"))
+          opt_ai = ai_maze;
+        else
+          usage(argv[0]);
+        break;
+      case 'f':
+        opt_reload = 1;
+        break;
+      case 'i':
+        opt_inlog = optarg;
+        break;
+      case 'k':
+        opt_kfint = (uint32_t)atoi(optarg);
+        break;
+      case 'l':
+        if (!(opt_dsr = (uint32_t)atoi(optarg)))
+          usage(argv[0]);
+        break;
+      case 'o':
+        opt_csv = optarg;
+        break;
+      case 'p':
+        opt_replay = optarg;
+        break;
+      case 'r':
+        if (!(opt_baud = (uint32_t)atoi(optarg)))
+          usage(argv[0]);
+        break;
+      case 's':
+        opt_stats = 1;
+        break;
+      case 'w':
+        opt_overlay = 1;
+        break;
+      default:
+        usage(argv[0]);
+    }
+
   initialize();
+  inlog_open();
 #ifndef FORCE_CURSES                // Skip page() if using curses
   page();
 #endif
@@ -0,0 +1,1635 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pmcore.h"
+
+// Pacman game rules. Francois Laagel. Jan-Jun 2024.
+//
+// Everything here operates on an explicit game_t. Nothing is
+// displayed: entities select their sprite glyph and the front end
+// composes the screen from game_grid() and the entity vector at the
+// end of every clock cycle.
+
+// Forward references...
+void super_enter(game_t *gs);
+void super_leave(game_t *gs);
+void entity_init(game_t *gs, entity *ep, uint8_t hcvr, uint8_t hcpc,
+  uint8_t vrow, uint8_t pcol, uint8_t cdir);
+uint8_t in_ghosts_pen(entity *self);
+void exits_build(game_t *gs);
+void maze_build(game_t *gs);
+
+// ------------------------------------------------------------
+// Pseudo-random number generator.
+
+// Using John Metcalf's Xorshift LFSRs PRNG.
+// http://www.retroprogramming.com/2017/07/
+//   xorshift-pseudorandom-numbers-in-z80.html
+uint16_t
+prandom(game_t *gs) {
+  gs->seed ^= gs->seed << 7;
+  gs->seed ^= gs->seed >> 9;
+  gs->seed ^= gs->seed << 8;
+  return gs->seed;
+}
+
+// CRC-32 (IEEE 802.3), bitwise.
+uint32_t
+crc32_update(uint32_t crc, const uint8_t *p, uint32_t len) {
+  uint32_t i;
+
+  while (len--) {
+    crc ^= *p++;
+    for (i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return crc;
+}
+
+uint32_t
+crc32(const uint8_t *p, uint32_t len) {
+  return ~crc32_update(0xFFFFFFFF, p, len);
+}
+
+void
+put_le32(uint8_t *p, uint32_t val) {
+  p[0] = val;
+  p[1] = val >> 8;
+  p[2] = val >> 16;
+  p[3] = val >> 24;
+}
+
+uint32_t
+get_le32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// ------------------------------------------------------------
+// Events.
+
+void
+ev_push(game_t *gs, evtype_t type) {
+  if (gs->ev.n == EVMAX)
+    crash_and_burn("ev_push: event list overflow");
+  gs->ev.ev[gs->ev.n++] = type;
+}
+
+void
+update_score(game_t *gs, uint32_t delta) {
+  gs->score += delta;
+  ev_push(gs, ev_score);
+}
+
+void
+update_lives(game_t *gs) {
+  gs->lives--;             // Always goes down!
+  ev_push(gs, ev_lives);
+}
+
+void
+update_level(game_t *gs) {
+  gs->gamlev++;
+  ev_push(gs, ev_level);
+}
+
+void
+update_suptim(game_t *gs) {
+  gs->suptim += CLKPERIOD / 5;
+  ev_push(gs, ev_suptim);
+}
+
+// ------------------------------------------------------------
+// Grid initialization.
+
+// 33 columns (double width characters) by 23 rows.
+const char *maze[NROW] = {
+  "AEEEEEEEGEEEEEEEEEEEEEEEGEEEEEEEB",
+  "FL K K KFK K K K K K K KFK K K LF",
+  "F AEEEP Q OEEEEEEEEEEEP Q OEEEB F",
+  "FKFK K K K K K K K K K K K K KFKF",
+  "F Q S S OEP OEEEEEEEP OEP S S Q F",
+  "FK KFKFK K K K K K K K K KFKFK KF",
+  "JEP F Q OEEEB OEEEP AEEEP Q F OEI",
+  "FK KFK K K KFK K K KFK K K KFK KF",
+  "F S Q OEEEB F ATTTB F AEEEP Q S F",
+  "FKFK K K KFKFKF   FKFKFK K K KFKF",
+  "F F OEEEP F F F   F F F OEEEP F F",
+  "FKFK K K KFKFKF   FKFKFK K K KFKF",
+  "F CEP S S Q Q CEEED Q Q S S OED F",
+  "FK K KFKFK K K K K K K KFKFK K KF",
+  "F OEEED Q S OEEEEEEEP S Q CEEEP F",
+  "FK K K K KFK K K K K KFK K K K KF",
+  "F OEGEEEP Q OEEEEEEEP Q OEEEGEP F",
+  "FK KFK K K K K K K K K K K KFK KF",
+  "JEP F OEP S OEEEEEEEP S OEP F OEI",
+  "FK KFK K KFK K K K K KFK K KFK KF",
+  "F OEHEEEP F OEEEEEEEP F OEEEHEP F",
+  "FL K K K KFK K K K K KFK K K K LF",
+  "CEEEEEEEEEHEEEEEEEEEEEHEEEEEEEEED"
+};
+
+// Initialize the grid contents. They will be displayed by the
+// compositor at the end of the current clock cycle.
+// By design no instanciated object should be referenced here.
+// The maze never changes: only the first level entry builds its
+// planes, the next ones just lay the items out again.
+void
+dot_initial_grid(game_t *gs) {
+  if (!gs->maze_ok)
+    maze_build(gs);
+  memcpy(gs->bb_cross, gs->bb_cross0, sizeof(gs->bb_cross));
+  memcpy(gs->bb_pellet, gs->bb_pellet0, sizeof(gs->bb_pellet));
+}
+
+// ------------------------------------------------------------
+// Bit planes.
+
+// dst[cell] = src[cell + n], zero past the last cell. 0 < n < 64.
+void
+plane_next(uint32_t *dst, const uint32_t *src, uint32_t n) {
+  uint32_t w, q = n >> 5, r = n & 31, lo, hi;
+
+  for (w = 0; w < BBWORDS; w++) {
+    lo = w + q < BBWORDS ? src[w + q] : 0;
+    hi = w + q + 1 < BBWORDS ? src[w + q + 1] : 0;
+    dst[w] = r ? lo >> r | hi << (32 - r) : lo;
+  }
+}
+
+// dst[cell] = src[cell - n], zero before the first cell. 0 < n < 64.
+void
+plane_prev(uint32_t *dst, const uint32_t *src, uint32_t n) {
+  uint32_t w, q = n >> 5, r = n & 31, lo, hi;
+
+  for (w = 0; w < BBWORDS; w++) {
+    lo = w >= q ? src[w - q] : 0;
+    hi = w >= q + 1 ? src[w - q - 1] : 0;
+    dst[w] = r ? lo << r | hi >> (32 - r) : lo;
+  }
+}
+
+uint32_t
+popcount32(uint32_t x) {
+#ifdef __GNUC__
+  return __builtin_popcount(x);
+#else
+  x -= (x >> 1) & 0x55555555;
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0F0F0F0F;
+  return (x * 0x01010101) >> 24;
+#endif
+}
+
+// Index of the lowest bit set in 'x', which must be NZ.
+uint32_t
+lowbit32(uint32_t x) {
+#ifdef __GNUC__
+  return __builtin_ctz(x);
+#else
+  return popcount32((x & -x) - 1);
+#endif
+}
+
+// Build the planes of the maze, its exit masks and the items laid
+// out at level entry.
+void
+maze_build(game_t *gs) {
+  uint32_t row, col, cell;
+  entity pos;
+
+  memset(gs->bb_wall, 0, sizeof(gs->bb_wall));
+  memset(gs->bb_cross0, 0, sizeof(gs->bb_cross0));
+  memset(gs->bb_pellet0, 0, sizeof(gs->bb_pellet0));
+  memset(gs->bb_door, 0, sizeof(gs->bb_door));
+  memset(gs->bb_pen, 0, sizeof(gs->bb_pen));
+  for (row = 0, cell = 0; row < NROW; row++)
+    for (col = 0; col < NCOL; col++, cell++) {
+      switch ((uint8_t)maze[row][col]) {
+        case cross:
+          BB_SET(gs->bb_cross0, cell);
+          break;
+        case pellet:
+          BB_SET(gs->bb_pellet0, cell);
+          break;
+        case door:
+          BB_SET(gs->bb_door, cell);
+          break;
+        case ' ':
+          break;
+        default:
+          BB_SET(gs->bb_wall, cell);
+      }
+      pos.vrown = 2 * row;
+      pos.pcoln = 2 * col;
+      if (in_ghosts_pen(&pos))
+        BB_SET(gs->bb_pen, cell);
+    }
+  gs->maze_ok = 1;
+  exits_build(gs);
+}
+
+// The grid glyphs, for rendering and digests. Walls and the door
+// come from the maze, the items from their planes.
+void
+game_grid(game_t *gs, uint8_t *grid) {
+  uint32_t row, w, m;
+
+  if (!gs->gamlev || !gs->maze_ok) {
+    memset(grid, 0, GRIDSIZE);   // No level entered yet
+    return;
+  }
+  for (row = 0; row < NROW; row++)
+    memcpy(grid + NCOL * row, maze[row], NCOL);
+  for (w = 0; w < BBWORDS; w++)  // Blank out what has been eaten
+    for (m = (gs->bb_cross0[w] | gs->bb_pellet0[w]) &
+      ~(gs->bb_cross[w] | gs->bb_pellet[w]); m; m &= m - 1)
+      grid[32 * w + lowbit32(m)] = ' ';
+}
+
+// Items left: once none, the next step enters a new level.
+uint32_t
+game_nremitem(game_t *gs) {
+  uint32_t w, n = 0;
+
+  for (w = 0; w < BBWORDS; w++)
+    n += popcount32(gs->bb_cross[w] | gs->bb_pellet[w]);
+  return n;
+}
+
+// TRUE if the level is complete (or not entered yet).
+uint32_t
+level_cleared(game_t *gs) {
+  uint32_t w, any = 0;
+
+  for (w = 0; w < BBWORDS; w++)
+    any |= gs->bb_cross[w] | gs->bb_pellet[w];
+  return !any;
+}
+
+// ------------------------------------------------------------
+// Animation objects.
+
+// Returns PM's current sprite glyph.
+uint8_t
+pacman_glyph(game_t *gs) {
+  uint8_t seldir;   // PM's current moving direction
+
+  if (PACMAN_ADDR->gobbling) {
+    PACMAN_ADDR->gobbling--;
+    return 'R';     // Pacman gobbling
+  }
+
+  seldir = PACMAN_ADDR->cdir == dir_blocked ?
+    PACMAN_ADDR->pdir : PACMAN_ADDR->cdir;
+  switch (seldir) {
+    case dir_right:
+      return 'M';
+    case dir_left:
+      return 'U';
+    case dir_up:
+      return 'V';
+    case dir_down:
+      return 'W';
+  }
+
+  crash_and_burn("pacman_glyph: invalid current direction");
+
+  // Avoid useless compiler warning.
+  return ' ';
+}
+
+// Entity method. This selects the sprite glyph. Actual drawing
+// is left to the compositor.
+void
+entity_display(game_t *gs, entity *self) {
+  if (!self->inum) {
+    self->glyph = pacman_glyph(gs);
+    return;
+  }
+
+  if (self->inum >= NENTITY)
+    crash_and_burn("entity_display: unknown instance number");
+
+  // Blinky, Inky, Pinky and Clyde, plain or in reverse video.
+  self->glyph = (gs->fright_timer ? "[\\]^" : "NXYZ")[self->inum - 1];
+}
+
+uint32_t
+bitclear(uint32_t val, uint32_t bitno) {
+  return val & (~(1 << bitno));
+}
+
+uint32_t
+is_bitset(uint32_t val, uint32_t bitno) {
+  return val & (1 << bitno);
+}
+
+uint32_t
+to_grid_space(uint32_t pcol) {
+  return pcol >> 1;
+}
+
+void
+entity_vector_init(game_t *gs) {
+  // By convention, we have PM as instance #0.
+  // This is a central assumption though!
+  entity_init(gs, &gs->ent[0], -1, -1, 34, 32, dir_right);
+
+  // Blinky is entity #1, Red, default design. North central ghost.
+  entity_init(gs, &gs->ent[1], 4, 60, 14, 32, dir_left);
+
+  // Pinky is entity #2, Pink, frowning. Central ghost.
+  entity_init(gs, &gs->ent[2], 4, 2, 20, 32, dir_up);
+
+  // Inky is entity #3, Cyan, nosy. Western ghost.
+  entity_init(gs, &gs->ent[3], 40, 62, 20, 30, dir_down);
+
+  // Clyde is entity #4, Orange, smiling, Eastern ghost.
+  entity_init(gs, &gs->ent[4], 40, 2, 20, 34, dir_left);
+}
+
+// ------------------------------------------------------------
+// Entity navigation.
+
+// If moving horizontally, the resulting pcol must be
+// >= 2 and < 64.
+// TODO: does the parameter really need to be passed as a 32 bit value?
+uint8_t
+is_valid_pcol(uint32_t pcol) {
+  return pcol >=2 && pcol < 64;
+}
+
+// If moving vertically, the resulting vrow number must be
+// >= 2 and < 44.
+// TODO: does the parameter really need to be passed as a 32 bit value?
+uint8_t
+is_valid_vrow(uint32_t vrow) {
+  return vrow >=2 && vrow < 44;
+}
+
+uint8_t
+is_scorable(uint8_t uchar) {
+  return uchar == cross || uchar == pellet;
+}
+
+uint8_t
+is_erasable(uint8_t uchar) {
+  return uchar == ' ' || is_scorable(uchar);
+}
+
+uint8_t
+is_erasable_or_door(uint8_t uchar) {
+  return uchar == door || is_erasable(uchar);
+}
+
+uint8_t
+in_ghosts_pen(entity *self) {
+  uint8_t vrow = self->vrown,
+    pcol = self->pcoln;
+
+  return vrow >= 16 && vrow < 23 &&
+    pcol >= 30 && pcol < 35;
+}
+
+// Returns the grid cell number of [vrow, pcol].
+uint32_t
+get_grid_cell(uint8_t pcol, uint8_t vrow) {
+  // Enforce assumptions.
+  if (!is_valid_vrow(vrow))
+    crash_and_burn("get_grid_cell: vrow is out of bounds");
+  if (!is_valid_pcol(pcol))
+    crash_and_burn("get_grid_cell: pcol is out of bounds");
+
+  return NCOL * to_grid_space(vrow) + to_grid_space(pcol);
+}
+
+// Level load pass: the exit masks of every tile, from the bit
+// planes, a word at a time. A tile is open if it is neither a wall
+// nor the door. The maze border is all walls, so moving from an
+// open tile never leads outside the valid coordinate range (vrow in
+// [2, 44), pcol in [2, 64)). The door is not open and still may be
+// crossed if:
+// 1: we're a ghost (i.e. not pacman) AND
+// 2: the originating coordinates are inside the ghosts' pen.
+// In essence, the ghosts' pen door _is_ an erasable but only for
+// the ghosts when they are inside of the pen.
+void
+exits_build(game_t *gs) {
+  uint32_t open[BBWORDS], to[4][BBWORDS], todoor[4][BBWORDS];
+  uint32_t w, b, v, cell, dir, i;
+
+  for (w = 0; w < BBWORDS; w++)
+    open[w] = ~(gs->bb_wall[w] | gs->bb_door[w]);
+  open[BBWORDS - 1] &= ~0u >> (32 * BBWORDS - GRIDSIZE);
+
+  // to[dir][cell]: the neighbour in direction 'dir' is open.
+  plane_prev(to[dir_up], open, NCOL);
+  plane_prev(to[dir_left], open, 1);
+  plane_next(to[dir_down], open, NCOL);
+  plane_next(to[dir_right], open, 1);
+  plane_prev(todoor[dir_up], gs->bb_door, NCOL);
+  plane_prev(todoor[dir_left], gs->bb_door, 1);
+  plane_next(todoor[dir_down], gs->bb_door, NCOL);
+  plane_next(todoor[dir_right], gs->bb_door, 1);
+  for (dir = dir_up; dir < dir_blocked; dir++)
+    for (w = 0; w < BBWORDS; w++)
+      todoor[dir][w] = (todoor[dir][w] & gs->bb_pen[w]) | to[dir][w];
+
+  // Four cells at a time: multiplying a nibble by 0x00204081 moves
+  // its bit i to bit 8*i, one byte per cell.
+  for (cell = 0; cell < GRIDSIZE; cell += 4) {
+    w = cell >> 5;
+    b = cell & 31;
+    v = 0;
+    for (dir = dir_up; dir < dir_blocked; dir++) {
+      v |= ((to[dir][w] >> b & 15) * 0x00204081 & 0x01010101) << dir;
+      v |= ((todoor[dir][w] >> b & 15) * 0x00204081 & 0x01010101) <<
+        (4 + dir);
+    }
+    for (i = 0; i < 4 && cell + i < GRIDSIZE; i++)
+      gs->exits[cell + i] = v >> 8 * i;
+  }
+}
+
+// ------------------------------------------------------------
+// Maze distances (ai_maze).
+
+#define MAZEDIST_NONE 0xFFFF
+
+// The table has a row per tile, filled by a BFS from that tile.
+// Each BFS moves its whole frontier at once: the frontier plane is
+// shifted in the four directions and whatever walkable cell it
+// reaches for the first time forms the next one. The maze border
+// is all walls, so a shift never wraps a row onto the next one.
+// Release it with mazedist_free().
+void
+mazedist_build(mazedist_t *md) {
+  static const int32_t drow[4] = { -1, 0, 1, 0 },
+    dcol[4] = { 0, -1, 0, 1 };
+  uint32_t walk[BBWORDS], seen[BBWORDS], front[BBWORDS];
+  uint32_t nb[4][BBWORDS];
+  uint32_t cell, w, m, d, any, head, tail, dir, ntile;
+  int32_t row, col;
+  uint16_t queue[GRIDSIZE];
+  uint8_t *dp;
+  game_t gs;
+
+  game_init(&gs);
+  dot_initial_grid(&gs);
+  for (w = 0; w < BBWORDS; w++)
+    walk[w] = ~gs.bb_wall[w];
+  walk[BBWORDS - 1] &= ~0u >> (32 * BBWORDS - GRIDSIZE);
+
+  // Number the tiles, then lend every wall the tile nearest to it,
+  // with a BFS from all the tiles at once.
+  ntile = head = tail = 0;
+  for (cell = 0; cell < GRIDSIZE; cell++)
+    if (BB_TEST(walk, cell)) {
+      md->tile[cell] = ntile++;
+      queue[tail++] = cell;
+    }
+    else
+      md->tile[cell] = MAZEDIST_NONE;
+  while (head < tail) {
+    cell = queue[head++];
+    for (dir = dir_up; dir < dir_blocked; dir++) {
+      row = cell / NCOL + drow[dir];
+      col = cell % NCOL + dcol[dir];
+      if (row < 0 || row >= NROW || col < 0 || col >= NCOL ||
+        md->tile[NCOL * row + col] != MAZEDIST_NONE)
+        continue;
+      md->tile[NCOL * row + col] = md->tile[cell];
+      queue[tail++] = NCOL * row + col;
+    }
+  }
+
+  if (!(md->d = malloc(ntile * ntile)))
+    crash_and_burn("mazedist_build: malloc returned NULL");
+  memset(md->d, MAZEDIST_INF, ntile * ntile);
+  md->ntile = ntile;
+
+  for (cell = 0; cell < GRIDSIZE; cell++) {
+    if (!BB_TEST(walk, cell))
+      continue;
+    dp = md->d + ntile * md->tile[cell];
+    dp[md->tile[cell]] = 0;
+    memset(seen, 0, sizeof(seen));
+    memset(front, 0, sizeof(front));
+    BB_SET(seen, cell);
+    BB_SET(front, cell);
+    for (d = 1, any = 1; any; d++) {
+      plane_prev(nb[dir_up], front, NCOL);
+      plane_prev(nb[dir_left], front, 1);
+      plane_next(nb[dir_down], front, NCOL);
+      plane_next(nb[dir_right], front, 1);
+      for (w = 0, any = 0; w < BBWORDS; w++) {
+        front[w] = (nb[dir_up][w] | nb[dir_left][w] | nb[dir_down][w] |
+          nb[dir_right][w]) & walk[w] & ~seen[w];
+        seen[w] |= front[w];
+        any |= front[w];
+      }
+      if (any && d >= MAZEDIST_INF)
+        crash_and_burn("mazedist_build: path too long");
+      for (w = 0; w < BBWORDS; w++)
+        for (m = front[w]; m; m &= m - 1)
+          dp[md->tile[32 * w + lowbit32(m)]] = d;
+    }
+  }
+  game_free(&gs);
+}
+
+void
+mazedist_free(mazedist_t *md) {
+  free(md->d);
+  md->d = NULL;
+}
+
+// The tile a ghost heads for, from its target in virtual space.
+// Targets may lie off the grid or on a wall: the nearest tile
+// stands in for them.
+uint32_t
+mazedist_target(const mazedist_t *md, int8_t tvr, int8_t tpc) {
+  int32_t row = tvr / 2, col = tpc / 2;
+
+  row = row < 0 ? 0 : (row >= NROW ? NROW - 1 : row);
+  col = col < 0 ? 0 : (col >= NCOL ? NCOL - 1 : col);
+  return md->tile[NCOL * row + col];
+}
+
+// Select the ghost AI of a game fresh from game_init(). ai_maze
+// reads the distance table 'md', built by the caller and left alone
+// until the game is over; NULL will do until the ghosts first move.
+// Copies of the game_t share the table, game_restore() keeps it.
+void
+game_set_ghostai(game_t *gs, ghostai_t ai, const mazedist_t *md) {
+  gs->ai = ai;
+  gs->md = md;
+}
+
+// Note: ghost_dirselect() guarantees us that both pcoln and
+// vrown are even, as does pacman_dirselect().
+uint8_t
+can_move_in_dir(game_t *gs, entity *self, uint8_t dir) {
+  uint8_t x;
+
+  if (dir >= dir_blocked)
+    crash_and_burn("can_move_in_dir: invalid dir");
+
+  x = gs->exits[NCOL * to_grid_space(self->vrown) +
+    to_grid_space(self->pcoln)];
+  return (self->inum ? EXITS_GHOST(x) : EXITS_PM(x)) >> dir & 1;
+}
+
+// Utility routine--not a method.
+void
+entity_reset_coords_and_dir(entity *self) {
+  self->cdir = self->dir0;
+  self->vrown = self->vrow0;
+  self->pcoln = self->pcol0;
+}
+
+// The dying animation is played by the front end, from what is
+// recorded here along with ev_death.
+void
+pacman_dying_routine(game_t *gs) {
+  evlist_t *el = &gs->ev;
+  uint8_t i, j;
+  entity *ep;
+
+  for (i = 0; i < NENTITY; i++) {
+    ep = &gs->ent[i];
+    el->death_sprite[i].vrown = ep->vrown;
+    el->death_sprite[i].pcoln = ep->pcoln;
+    el->death_sprite[i].glyph = ep->glyph;
+  }
+
+  for (i = 0; i < 4; i++)   // 4 self rotations
+    for (j = dir_up; j < dir_blocked; j++) {
+       PACMAN_ADDR->cdir = j;
+       entity_display(gs, PACMAN_ADDR);
+       el->death_glyph[4 * i + j] = PACMAN_ADDR->glyph;
+    }
+  ev_push(gs, ev_death);
+
+  gs->fright_timer = 0;     // PM no longer "supercharged"
+  PACMAN_ADDR->reward = 0;  // Reset the 'reward' field
+
+  // Every entity returned to its original upright position.
+  for (i = 0; i < NENTITY; i++) {
+    ep = &gs->ent[i];
+
+    // Blank current entity location.
+    ep->glyph = 0;
+
+    if (i) {
+      // Keep the ghosts mostly harmless for a little time.
+      ep->resurr = 20;
+    }
+
+    // Generic death handling.
+    entity_reset_coords_and_dir(ep);
+    ep->inited = 0;
+  }
+}
+
+// TODO: omitted debugging support code.
+
+uint8_t
+is_pacman_stepped_on(game_t *gs, entity *ghost) {
+  uint8_t pm_grow, pm_gcol;
+
+  if (!ghost->inum)      // This cannot be applied to PM itself!!!
+    crash_and_burn("is_pacman_stepped_on: applied to PM");
+
+  pm_grow = to_grid_space(PACMAN_ADDR->vrown);
+  pm_gcol = to_grid_space(PACMAN_ADDR->pcoln);
+  return (pm_grow == to_grid_space(ghost->vrown)) &&
+    (pm_gcol == to_grid_space(ghost->pcoln));
+}
+
+dir_t
+pacman_dirselect(game_t *gs, entity *self) {
+  dir_t rv;
+
+  // Keyboard input has already been stored in 'idir' by
+  // game_step().
+
+  // No direction changes unless both vrow# and pcol# are even.
+  if ((self->vrown & 1) || (self->pcoln & 1))
+    return (dir_t)(self->cdir);
+
+  // If idir is not dir_unspec AND we can move in idir:
+  // - queue up idir as the return value.
+  // - reset idir to dir_unspec.
+  // - end of story.
+  if (self->idir != dir_unspec &&
+    can_move_in_dir(gs, self, self->idir)) {
+      rv = (dir_t)(self->idir);
+      self->idir = dir_unspec;
+      return rv;
+  }
+
+  // Default policy: keep the current direction unless blocked.
+  if (self->cdir == dir_blocked)
+    return dir_blocked;
+
+  if (can_move_in_dir(gs, self, self->cdir))
+    return (dir_t)(self->cdir);
+
+  self->pdir = self->cdir;
+  return dir_blocked;
+}
+
+// This is a tricky one since the original Forth code returns
+// FALSE|dir\TRUE, i.e. a variable outcome. We can't have that
+// kind of flexibility in C.
+int8_t
+only_one_dir(uint32_t bm) {
+  switch (bm) {
+    case 1:
+      return 0;
+    case 2:
+      return 1;
+    case 4:
+      return 2;
+    case 8:
+      return 3;
+  }
+
+  return -1;     // For the lack of a better alternative...
+}
+
+// The following implements the frightened ghost mode.
+// 'bitmap' has the superposition of viable alternatives, in terms
+// of possible directions for a ghost.
+dir_t
+ghost_dirselect_fright(game_t *gs, entity *ep, uint32_t bitmap) {
+  uint8_t bit0;
+  dir_t dir;
+
+  (void)ep;           // The parameter is passed and ignored. So it goes...
+
+  for (dir = dir_up; dir < dir_blocked; dir++) {
+    bit0 = bitmap & 1;
+    bitmap >>= 1;
+    if (bit0) {       // dir is an option
+      if (bitmap) {   // There are other possible directions
+        if (prandom(gs) & 8)
+          return dir; // Select direction 'dir'
+      }
+      else            // There are no alternatives left
+        return dir;
+    }
+  }
+
+  crash_and_burn("ghost_dirselect_fright: no viable direction found");
+
+  // Avoid useless compiler warning.
+  return dir_down;
+}
+
+// ai_maze: for every bit set in bitmap, look up the maze distance
+// from the neighbouring tile to the target tile and return the
+// direction that minimizes it. One table row serves all four
+// candidates. Ties go to the first direction, as below.
+dir_t
+ghost_dirselect_nav2tile(game_t *gs, entity *self, uint32_t bitmap,
+  int8_t tvr, int8_t tpc) {
+  static const int32_t step[4] = { -NCOL, -1, NCOL, 1 };
+  const mazedist_t *md = gs->md;
+  const uint8_t *dp;
+  uint32_t cell, minval = MAZEDIST_INF + 1;
+  dir_t dir, dirmin = (dir_t)-1;
+
+  if (!md || !md->d)
+    crash_and_burn("ghost_dirselect_nav2tile: no distance table");
+
+  dp = md->d + md->ntile * mazedist_target(md, tvr, tpc);
+  cell = NCOL * to_grid_space(self->vrown) + to_grid_space(self->pcoln);
+  for (dir = dir_up; dir < dir_blocked; dir++)
+    if (is_bitset(bitmap, dir) && dp[md->tile[cell + step[dir]]] < minval) {
+      dirmin = dir;
+      minval = dp[md->tile[cell + step[dir]]];
+    }
+
+  if (dirmin == (dir_t)-1)
+    crash_and_burn("ghost_dirselect_nav2tile: no minimum found");
+
+  return dirmin;
+}
+
+// For every bit set in bitmap, we need to evaluate the
+// Euclidian distance between the potential next location and
+// the target tile. Finally we return the direction that
+// minimizes the distance.
+dir_t
+ghost_dirselect_nav2target(game_t *gs, entity *self, uint32_t bitmap,
+  int8_t tvr, int8_t tpc) {
+  int8_t pcol, vrow;
+  uint16_t minval = 65535, minnew;
+  int16_t dx, dy;
+  dir_t dir, dirmin = (dir_t)-1;
+
+  if (gs->ai == ai_maze)
+    return ghost_dirselect_nav2tile(gs, self, bitmap, tvr, tpc);
+
+  for (dir = dir_up; dir < dir_blocked; dir++) {
+    if (is_bitset(bitmap, dir)) {
+      pcol = (int8_t)self->pcoln;
+      vrow = (int8_t)self->vrown;
+
+      // Need to project into the next potential coordinates (in virtual space).
+      switch (dir) {
+        case dir_left:
+          pcol--;
+          break;
+        case dir_right:
+          pcol++;
+          break;
+        case dir_up:
+          vrow--;
+          break;
+        case dir_down:
+          vrow++;
+          break;
+        default:
+          crash_and_burn("ghost_dirselect_nav2target: unrecognized current "
+            "direction");
+      }
+
+      // We compare the distance to the target squared.
+      dx = ((int16_t)pcol) - ((int16_t)tpc);
+      dy = ((int16_t)vrow) - ((int16_t)tvr);
+      minnew = dx * dx + dy * dy;
+      if (minnew < minval) {
+        dirmin = dir;
+        minval = minnew;
+      }
+    }
+  }
+
+  if (dirmin == (dir_t)-1)
+    crash_and_burn("ghost_dirselect_nav2target: no minimum found");
+
+  return dirmin;
+}
+
+// In scatter mode, simply navigate to the ghost home corner.
+dir_t
+ghost_dirselect_scatter(game_t *gs, entity *self, uint32_t bitmap) {
+  return ghost_dirselect_nav2target(gs, self, bitmap, self->hcvrn,
+    self->hcpcn);
+}
+
+dir_t
+ghost_dirselect_chase(game_t *gs, entity *self, uint32_t bitmap) {
+  int8_t pcol, vrow;
+  entity *bp;
+  dir_t dir;
+
+  // Blinky handling. The target is PM's current location.
+  if (self->inum == 1)
+    return ghost_dirselect_nav2target(gs, self, bitmap, PACMAN_ADDR->vrown,
+      PACMAN_ADDR->pcoln);
+
+  // Pinky handling. The target is 8 half tiles in PM's
+  // current moving direction. It might be off the grid but
+  // that does not matter in the least.
+  if (self->inum == 2) {
+    // Project PM's future location based on its current direction
+    // by 8 tiles in virtual space.
+    vrow = (int8_t)PACMAN_ADDR->vrown;
+    pcol = (int8_t)PACMAN_ADDR->pcoln;
+
+
+    // PM maybe blocked. If it is, act on 'pdir' instead of 'cdir'.
+    dir = PACMAN_ADDR->cdir != dir_blocked ?
+      PACMAN_ADDR->cdir : PACMAN_ADDR->pdir;
+    switch (dir) {
+      case dir_left:
+        pcol -= 8;
+        break;
+      case dir_right:
+        pcol += 8;
+        break;
+      case dir_up:
+        vrow -= 8;
+        break;
+      case dir_down:
+        vrow += 8;
+        break;
+      default:
+        crash_and_burn("ghost_dirselect_chase: PM's current direction "
+          "not recognized (Pinky)");
+    }
+    return ghost_dirselect_nav2target(gs, self, bitmap, vrow, pcol);
+  }
+
+  // Inky handling. The target is at the end of a vector twice
+  // as long as the one originating from Blinky to PM's moving
+  // direction extrapolated by 4 half tiles.
+  if (self->inum == 3) {
+    vrow = (int8_t)PACMAN_ADDR->vrown;
+    pcol = (int8_t)PACMAN_ADDR->pcoln;
+
+    // PM maybe blocked. If it is, act on 'pdir' instead of 'cdir'.
+    dir = PACMAN_ADDR->cdir != dir_blocked ?
+      PACMAN_ADDR->cdir : PACMAN_ADDR->pdir;
+    switch (dir) {
+      case dir_left:
+        pcol -= 4;
+        break;
+      case dir_right:
+        pcol += 4;
+        break;
+      case dir_up:
+        vrow -= 4;
+        break;
+      case dir_down:
+        vrow += 4;
+        break;
+      default:
+        crash_and_burn("ghost_dirselect_chase: PM's current direction "
+          "not recognized (Inky)");
+    }
+
+    // For the record, Blinky is entity #1 in ent[].
+    bp = &gs->ent[1];
+    vrow = 2 * (vrow - bp->vrown);  // This is a delta on Y
+    pcol = 2 * (pcol - bp->pcoln);  // This is a delta on X
+
+    // The relative displacement refers to Blinky's current pos.
+    return ghost_dirselect_nav2target(gs, self, bitmap,
+      bp->vrown + vrow, bp->pcoln + pcol);
+  }
+
+  // Default policy. Will only apply to Clyde--permanently
+  // frightened in chase mode.
+  return ghost_dirselect_fright(gs, self, bitmap);
+}
+
+// From the "pacman dossier:"
+// "Ghosts are forced to reverse direction by the system anytime
+// the mode changes from: chase-to-scatter, chase-to-frightened,
+// scatter-to-chase, and scatter-to-frightened. Ghosts do not
+// reverse direction when changing back from frightened to chase
+// or scatter modes."
+//
+// Interpreting the gospel:
+// - 'reversing direction' means selecting opposite(cdir).
+//
+// The direction returned is guaranteed to be adopted by the
+// caller.
+dir_t
+ghost_dirselect(game_t *gs, entity *self) {
+  uint8_t bitmap = 0X0F;     // The sum of 'a priori' alternatives
+  uint8_t revreq = self->revflg;
+  dir_t dir;
+
+  // No direction changes unless both vrow# and pcol# are even.
+  if ((self->vrown & 1) || (self->pcoln & 1))
+    return (dir_t)(self->cdir);
+
+  if (revreq)               // Direction reversal is requested
+    self->revflg = 0;
+  else                      // Exclude opposite(cdir)
+    bitmap = bitclear(bitmap, (self->cdir + 2) & 3);
+
+  // Ascertain which directions are possible.
+  bitmap &= EXITS_GHOST(gs->exits[NCOL * to_grid_space(self->vrown) +
+    to_grid_space(self->pcoln)]);
+
+  // If we are inside of the ghosts' pen and the current
+  // direction remains open, ignore revflg and stick to that.
+  if (in_ghosts_pen(self) && is_bitset(bitmap, self->cdir))
+    return (dir_t)(self->cdir);
+
+  // Honor direction reversal requests.
+  if (revreq)
+    return (dir_t)((self->cdir + 2) & 3);
+
+  // Optimization: if bitmap is a power of two--only one
+  // direction is viable--return this direction immediately.
+  if ((dir = only_one_dir(bitmap)) != (int8_t)-1)
+    return dir;
+
+  // Ghost mode dependent behaviour.
+  switch (gs->gm_cur) {
+    case mode_fright:
+      return ghost_dirselect_fright(gs, self, bitmap);
+    case mode_scatter:
+      return ghost_dirselect_scatter(gs, self, bitmap);
+    case mode_chase:
+      return ghost_dirselect_chase(gs, self, bitmap);
+  }
+
+  crash_and_burn("ghost_dirselect: unsupported ghost mode");
+
+  // Avoid useless compiler warning.
+  return dir_down;
+}
+
+// Utility routine--not a method.
+void
+entity_initial_display(game_t *gs, entity *self) {
+  entity_display(gs, self);
+}
+
+// Utility routine--not a method.
+void
+entity_get_new_coordinates(entity *self, uint8_t *pcnew, uint8_t *vrnew) {
+  *pcnew = self->pcoln;
+  *vrnew = self->vrown;
+
+  // Handling a resurrecting/grounded ghost.
+  if (self->resurr) {
+    self->resurr--;
+    return;
+  }
+
+  switch (self->cdir) {
+    case dir_left:
+      (*pcnew)--;
+      break;
+    case dir_right:
+      (*pcnew)++;
+      break;
+    case dir_up:
+      (*vrnew)--;
+      break;
+    case dir_down:
+      (*vrnew)++;
+      break;
+    // dir_blocked (PM only): fall through.
+  }
+}
+
+// Utility routine--not a method.
+// Do not preserve erasables. Manage gobbling aspect. This
+// requires an update to the item planes. Update the score
+// accordingly.
+void
+pacman_moving_policy(game_t *gs, entity *self, uint8_t pcnew,
+  uint8_t vrnew) {
+  uint32_t cell;
+
+  // No change unless both 'pcnew' and 'vrnew' both are even.
+  if ((pcnew & 1) || (vrnew & 1))
+    return;
+
+  // Return immediately unless we have just consumed a cross or a pellet.
+  cell = get_grid_cell(pcnew, vrnew);
+  if (!BB_TEST(gs->bb_cross, cell) && !BB_TEST(gs->bb_pellet, cell))
+    return;
+
+  self->gobbling = 2;    // Gobble for two clock cycles
+
+  if (BB_TEST(gs->bb_cross, cell)) {
+    BB_CLR(gs->bb_cross, cell);
+    update_score(gs, 10);
+  }
+  else {
+    BB_CLR(gs->bb_pellet, cell);
+    update_score(gs, 50);
+    // Enter "supercharged" mode
+    // Note: we do not reset the 'reward' field here.
+    // Maybe we should--or not. This is a possible way
+    // to achieve wicked scores!!!
+    super_enter(gs);
+  }
+}
+
+// Utility routine--not a method.
+void
+collision_handle(game_t *gs, entity *ghost_addr, uint8_t *pcol,
+  uint8_t *vrow, uint8_t onproc) {
+
+  // Defensive programming: make sure the entity at '*ghost_addr' is a ghost.
+  if (((ghost_addr->inum < 1) || (ghost_addr->inum >= NENTITY)))
+    crash_and_burn("collision-handle: not a ghost at '*ghost_addr'");
+
+  if (gs->fright_timer) {
+    // The ghost at 'ghost_addr' dies--unless it is resurrecting.
+    // Note: only Blinky resurrects outside of the pen.
+    if (!ghost_addr->resurr) {
+      ghost_addr->resurr = 50; // Ghost grounded for 50 clk cycles
+
+      // Update the score based on PM's 'reward' field.
+      if (PACMAN_ADDR->reward)
+        PACMAN_ADDR->reward *= 2;
+      else
+        PACMAN_ADDR->reward = 2;
+      update_score(gs, 100 * ((uint32_t)PACMAN_ADDR->reward));
+
+      entity_reset_coords_and_dir(ghost_addr);
+
+      // Ghost returned to the pen.
+      if (onproc) {            // If the ghost just killed was ONPROC
+        // Replace anticipated coordinates with the updated ones.
+        *pcol = ghost_addr->pcoln;
+        *vrow = ghost_addr->vrown;
+      }
+    }
+    return;                    // We're done here
+  }
+
+  // PM dies
+  pacman_dying_routine(gs);
+  update_lives(gs);
+
+  if (!gs->lives) {
+    gs->over = 1;
+    ev_push(gs, ev_gameover);
+    return;
+  }
+
+  // If 'onproc' is zero, PM was ONPROC and we need to update
+  // *pcol/*vrow to match PM's post mortem coordinates.
+  if (!onproc) {
+    *pcol = PACMAN_ADDR->pcoln;
+    *vrow = PACMAN_ADDR->vrown;
+    return;                    // We're done here
+  }
+
+  // A ghost is ONPROC and is responsible for PM's death.
+  *pcol = ghost_addr->pcoln;
+  *vrow = ghost_addr->vrown;
+}
+
+// Entity method.
+void
+entity_move(game_t *gs, entity *self) {
+  uint8_t pcnew, vrnew;
+  int i;
+  entity *ghost_addr = NULL;
+
+  if (!self->inited) {
+    entity_initial_display(gs, self);
+    self->inited = 1;
+    return;
+  }
+
+  // 'cdir' validation.
+  if (self->cdir > dir_blocked)
+    crash_and_burn("entity_move: illegal current direction");
+
+  // dir_blocked should only be in effect for PM, which
+  // is an indication that some keyboard input is required.
+  if ((self->cdir == dir_blocked) && (self->inum != 0))
+    crash_and_burn("entity_move: ghost blocked!!!");
+
+  self->cdir = self->inum ? ghost_dirselect(gs, self) :
+    pacman_dirselect(gs, self);
+
+  // Retrieve projected coordinates.
+  entity_get_new_coordinates(self, &pcnew, &vrnew);
+
+  // Ghosts do not alter the grid. What they obscure is
+  // restored by the compositor.
+  if (!self->inum)
+    pacman_moving_policy(gs, self, pcnew, vrnew);
+
+  // Update entity's coordinates fields.
+  self->pcoln = pcnew;
+  self->vrown = vrnew;
+
+  // Collision handling.
+  if (self->inum           // A ghost is ONPROC
+    && is_pacman_stepped_on(gs, self))
+    ghost_addr = self;
+  else {                   // PM is ONPROC
+    // We have to check all possible ghosts' coordinates.
+    for (i = 1; i < NENTITY; i++)
+      if (is_pacman_stepped_on(gs, &gs->ent[i])) {
+        ghost_addr = &gs->ent[i];
+        break;
+      }
+  }
+
+  // TODO: the following is kinda dubious...
+  if (ghost_addr)
+    collision_handle(gs, ghost_addr, &pcnew, &vrnew, ghost_addr == self);
+  if (gs->over)
+    return;
+
+  // Display entity at new coordinates.
+  entity_display(gs, self);
+}
+
+uint32_t
+serialno_getnext(game_t *gs) {
+  return gs->serialno++;
+}
+
+// Entity constructor. 'ep' is a zeroed slot of gs->ent[].
+void
+entity_init(game_t *gs, entity *ep, uint8_t hcvr, uint8_t hcpc,
+  uint8_t vrow, uint8_t pcol, uint8_t cdir) {
+  // Initialize default valued fields.
+  ep->pdir = dir_blocked;
+  ep->idir = dir_unspec;
+
+  // Initialize fields from arguments.
+  ep->cdir = ep->dir0 = cdir;
+  ep->pcoln = ep->pcol0 = pcol;
+  ep->vrown = ep->vrow0 = vrow;
+  ep->hcvrn = hcvr;
+  ep->hcpcn = hcpc;
+
+  // Intrinsics.
+  ep->inum = serialno_getnext(gs);
+}
+
+// -------------------------------------------------------------
+// Ghost mode logic is time based but there's more to it than
+// just time. When PM becomes "supercharged" the ghosts
+// transition to the frightened state for some time.
+
+const int32_t gm_sched[][3] = {
+  //              L1      L2-4    L5+     seqno
+  /* Scatter */ { 7,      7,      5    }, // 0
+  /* Chase   */ { 20,     20,     20   }, // 1
+  /* Scatter */ { 7,      7,      5    }, // 2
+  /* Chase   */ { 20,     20,     20   }, // 3
+  /* Scatter */ { 5,      5,      5    }, // 4
+  /* Chase   */ { 20,     1033,   1037 }, // 5
+  /* Scatter */ { 5,      1,      1    }, // 6
+  /* Chase   */ { -1,     -1,     -1   }  // 6+ -> forever
+};
+
+// Returns a clock cycle count.
+// TODO: this code should be under scrutiny.
+int32_t
+gm_timer_initval_get(uint8_t level, uint8_t seqno) {
+  int32_t clk_cycles;
+  int offset;
+
+  // Defensive programming--enforce assumptions.
+  if (!level)
+    crash_and_burn("gm_timer_initval_get: level is zero");
+  // TODO: seqno should also be checked for consistency.
+
+  if (level == 1)
+    offset = 0;
+  else
+    offset = level < 5 ? 1 : 2;
+
+  clk_cycles = gm_sched[seqno][offset];
+  if (clk_cycles == -1)
+    return clk_cycles;
+
+  return (clk_cycles * 1000) / CLKPERIOD;
+}
+
+uint8_t
+gm_seqno_getnext(game_t *gs) {
+  // The sequence number is capped at 7.
+  return gs->gm_seqno < 6 ? 1 + gs->gm_seqno : 7;
+}
+
+// Called after a context change (sequence number or game level).
+ghostmode_t
+gm_getnext(game_t *gs) {
+  int32_t ncycles;
+
+  // Debugging code begins.
+  // gs->gm_timer_en = 0;
+  // return mode_chase;
+  // Debugging code ends.
+
+  gs->gm_timer_en = ncycles = gm_timer_initval_get(gs->gamlev, gs->gm_seqno);
+  if (ncycles != (int32_t)-1) {
+    gs->gm_timer = ncycles;
+    return gs->gm_seqno & 1 ? mode_chase : mode_scatter;
+  }
+
+  return mode_chase;
+}
+
+void
+gm_prv_update(game_t *gs) {
+  if (gs->gm_cur == mode_fright)
+    return;
+  gs->gm_prv = gs->gm_cur;
+}
+
+// All ghosts adopt the direction opposite to the current one.
+void
+gm_allghosts_reverse(game_t *gs) {
+  int i;
+
+  for (i = 1; i < NENTITY; i++)
+    gs->ent[i].revflg = 1;
+  ev_push(gs, ev_bell);
+}
+
+void
+gm_switchto(game_t *gs, ghostmode_t mode) {
+  if (mode == gs->gm_cur)
+    return;             // Current mode is not changing
+
+  // If switching away from chase or scatter modes, signal
+  // direction reversal request to all ghost instances.
+  if (gs->gm_cur != mode_fright)
+    gm_allghosts_reverse(gs);
+
+  gm_prv_update(gs);
+  gs->gm_cur = mode;
+}
+
+void
+super_enter(game_t *gs) {
+  gm_allghosts_reverse(gs);             // HackerB9's request
+
+  // We might want to return immediately depending on 'gamlev'
+  if (gs->gm_cur == mode_fright) {      // Already frightened
+    gs->fright_timer = SUPER_CLKCYCLES; // Be kind, reset the timer!
+    return;
+  }
+
+  gm_prv_update(gs);
+  gs->gm_cur = mode_fright;
+  gs->gm_timer_en = 0;                  // Suspend gm_timer
+  gs->fright_timer = SUPER_CLKCYCLES;   // Enable the 'fright' timer
+}
+
+void
+super_leave(game_t *gs) {
+  PACMAN_ADDR->reward = 0;              // Reset ghost kill counter
+  gm_switchto(gs, gs->gm_prv);
+  gs->gm_timer_en = -1;                 // Re-enable gm_timer
+}
+
+// -------------------------------------------------------------
+// Reset all entities coords/dir and set 'inited' to FALSE.
+// Also clear 'fright_timer' and PM's 'reward' field.
+// Reset the PRNG's seed to a fixed value, as per the gospel.
+
+void
+level_entry_inits(game_t *gs) {
+  entity *ep;
+  int i;
+
+  entity_reset_coords_and_dir(PACMAN_ADDR);
+  PACMAN_ADDR->inited = 0;
+  PACMAN_ADDR->reward = 0;
+  PACMAN_ADDR->glyph = 0;
+
+  for (i = 1; i < NENTITY; i++) {
+    ep = &gs->ent[i];
+    entity_reset_coords_and_dir(ep);
+    ep->inited = 0;
+    ep->glyph = 0;
+  }
+
+  gs->seed = 23741;
+
+  // Ghost mode level entry initializations.
+  gs->fright_timer = 0;
+  gs->gm_seqno = 0;
+  gs->gm_cur = gm_getnext(gs);
+  gs->gm_prv = mode_unspec;
+}
+
+// -------------------------------------------------------------
+// Interface.
+
+void
+game_init(game_t *gs) {
+  memset(gs, 0, sizeof(*gs));
+  gs->serialno = 0;
+  entity_vector_init(gs);
+
+  gs->hiscore = 0;        // Make this somehow persistent!
+  gs->score = 0;
+  gs->lives = 3;
+  gs->gamlev = 0;
+  gs->bonus = 0;
+  gs->suptim = 0;
+  gs->gm_cur = mode_scatter;
+  gs->gm_prv = mode_unspec;
+  gs->gm_timer_en = -1;   // Enable ghost mode scheduler
+  gs->ai = ai_euclid;     // See game_set_ghostai()
+  gs->md = NULL;
+  // No items left: the first step enters level #1.
+}
+
+// Nothing to release since the entities live in the game_t. Kept
+// so that front ends need not care.
+void
+game_free(game_t *gs) {
+  (void)gs;
+}
+
+// One clock cycle. 'input' is PM's intended direction, as typed
+// since the previous step, or dir_unspec. A step entering a new
+// level (ev_level) only sets the scene. Once ev_gameover has been
+// reported, the game must not be stepped any further.
+const evlist_t *
+game_step(game_t *gs, uint8_t input) {
+  int i;
+
+  gs->ev.n = 0;
+  gs->tick++;
+  if (input < dir_blocked)
+    PACMAN_ADDR->idir = input;
+
+  if (level_cleared(gs)) {        // No items left, start new level
+    dot_initial_grid(gs);
+    update_level(gs);
+    level_entry_inits(gs);
+    return &gs->ev;
+  }
+
+  // Ghost mode handling.
+  if (gs->gm_cur == mode_fright) {
+    if (gs->fright_timer) {       // Continue w/ frightened ghosts
+      gs->fright_timer--;
+      update_suptim(gs);
+    }
+    else
+      super_leave(gs);
+  }
+  else {
+    if (gs->gm_timer_en) {
+      if (gs->gm_timer)
+        gs->gm_timer--;           // Ghost mode unchanged
+      else {
+        gs->gm_seqno = gm_seqno_getnext(gs);
+        gm_switchto(gs, gm_getnext(gs));
+      }
+    }
+  }
+
+  // Regular entity scheduling.
+  for (i = 0; i < NENTITY && !gs->over; i++)
+    entity_move(gs, &gs->ent[i]);
+  return &gs->ev;
+}
+
+// Entity fields in their canonical order, which the digest and the
+// serialized snapshots depend on. The entity struct is free to be
+// rearranged.
+void
+ent_save(entsnap_t *sp, const entity *ep) {
+  sp->resurr = ep->resurr;
+  sp->reward = ep->reward;
+  sp->vrown = ep->vrown;
+  sp->pcoln = ep->pcoln;
+  sp->glyph = ep->glyph;
+  sp->pcol0 = ep->pcol0;
+  sp->vrow0 = ep->vrow0;
+  sp->dir0 = ep->dir0;
+  sp->hcvrn = ep->hcvrn;
+  sp->hcpcn = ep->hcpcn;
+  sp->cdir = ep->cdir;
+  sp->pdir = ep->pdir;
+  sp->idir = ep->idir;
+  sp->revflg = ep->revflg;
+  sp->inited = ep->inited;
+  sp->gobbling = ep->gobbling;
+  sp->inum = ep->inum;
+}
+
+void
+ent_load(entity *ep, const entsnap_t *sp) {
+  ep->resurr = sp->resurr;
+  ep->reward = sp->reward;
+  ep->vrown = sp->vrown;
+  ep->pcoln = sp->pcoln;
+  ep->glyph = sp->glyph;
+  ep->pcol0 = sp->pcol0;
+  ep->vrow0 = sp->vrow0;
+  ep->dir0 = sp->dir0;
+  ep->hcvrn = sp->hcvrn;
+  ep->hcpcn = sp->hcpcn;
+  ep->cdir = sp->cdir;
+  ep->pdir = sp->pdir;
+  ep->idir = sp->idir;
+  ep->revflg = sp->revflg;
+  ep->inited = sp->inited;
+  ep->gobbling = sp->gobbling;
+  ep->inum = sp->inum;
+}
+
+// Fingerprint of the game state: counters, ghost mode, grid and
+// entities, in a fixed order. Two games that evolved identically
+// have the same digest.
+uint32_t
+game_digest(game_t *gs) {
+  uint32_t v[16], crc, n = 0, i;
+  uint8_t buf[4 * 16], grid[GRIDSIZE];
+  entsnap_t es;
+
+  v[n++] = gs->seed;
+  v[n++] = gs->score;
+  v[n++] = gs->lives;
+  v[n++] = gs->gamlev;
+  v[n++] = gs->suptim;
+  v[n++] = game_nremitem(gs);
+  v[n++] = gs->gm_cur;
+  v[n++] = gs->gm_prv;
+  v[n++] = (uint32_t)gs->gm_timer_en;
+  v[n++] = gs->gm_seqno;
+  v[n++] = gs->gm_timer;
+  v[n++] = gs->fright_timer;
+  v[n++] = gs->over;
+  if (gs->ai != ai_euclid)       // Other rules. The arcade's leave
+    v[n++] = gs->ai;             // the digest as it always was
+  for (i = 0; i < n; i++) {      // Little endian, whatever the host
+    buf[4 * i] = v[i];
+    buf[4 * i + 1] = v[i] >> 8;
+    buf[4 * i + 2] = v[i] >> 16;
+    buf[4 * i + 3] = v[i] >> 24;
+  }
+
+  crc = crc32_update(0xFFFFFFFF, buf, 4 * n);
+  game_grid(gs, grid);
+  crc = crc32_update(crc, grid, GRIDSIZE);
+  for (i = 0; i < NENTITY; i++) {
+    ent_save(&es, &gs->ent[i]);
+    crc = crc32_update(crc, &es.resurr, sizeof(entsnap_t));
+  }
+  return ~crc;
+}
+
+// ------------------------------------------------------------
+// Snapshots.
+
+// No padding anywhere, or memcmp() would compare garbage.
+typedef char snap_size_check[sizeof(snap_t) ==
+  SNAPSIZE + sizeof(((snap_t *)0)->spare) ? 1 : -1];
+
+void
+game_snapshot(game_t *gs, snap_t *sp) {
+  int i;
+
+  sp->seed = gs->seed;
+  sp->hiscore = gs->hiscore;
+  sp->score = gs->score;
+  sp->lives = gs->lives;
+  sp->gamlev = gs->gamlev;
+  sp->bonus = gs->bonus;
+  sp->suptim = gs->suptim;
+  sp->serialno = gs->serialno;
+  sp->gm_cur = gs->gm_cur;
+  sp->gm_prv = gs->gm_prv;
+  sp->gm_timer_en = (uint32_t)gs->gm_timer_en;
+  sp->gm_seqno = gs->gm_seqno;
+  sp->gm_timer = gs->gm_timer;
+  sp->fright_timer = gs->fright_timer;
+  sp->over = gs->over;
+  sp->tick = gs->tick;
+
+  memcpy(sp->bb_cross, gs->bb_cross, sizeof(sp->bb_cross));
+  memcpy(sp->bb_pellet, gs->bb_pellet, sizeof(sp->bb_pellet));
+  for (i = 0; i < NENTITY; i++)
+    ent_save(&sp->ent[i], &gs->ent[i]);
+  sp->ai = (uint8_t)gs->ai;
+  memset(sp->spare, 0, sizeof(sp->spare));
+}
+
+// The event list is emptied: it belongs to the step that produced it.
+// The maze planes are only built if the game_t never had them. The
+// distance table is the game_t's own: a game restored to a maze AI
+// state must have been given one (game_set_ghostai()).
+void
+game_restore(game_t *gs, const snap_t *sp) {
+  int i;
+
+  gs->seed = sp->seed;
+  gs->hiscore = sp->hiscore;
+  gs->score = sp->score;
+  gs->lives = sp->lives;
+  gs->gamlev = sp->gamlev;
+  gs->bonus = sp->bonus;
+  gs->suptim = sp->suptim;
+  gs->serialno = sp->serialno;
+  gs->gm_cur = sp->gm_cur;
+  gs->gm_prv = sp->gm_prv;
+  gs->gm_timer_en = (int32_t)sp->gm_timer_en;
+  gs->gm_seqno = sp->gm_seqno;
+  gs->gm_timer = sp->gm_timer;
+  gs->fright_timer = sp->fright_timer;
+  gs->over = sp->over;
+  gs->tick = sp->tick;
+
+  if (gs->gamlev && !gs->maze_ok)
+    maze_build(gs);
+  memcpy(gs->bb_cross, sp->bb_cross, sizeof(gs->bb_cross));
+  memcpy(gs->bb_pellet, sp->bb_pellet, sizeof(gs->bb_pellet));
+  for (i = 0; i < NENTITY; i++)
+    ent_load(&gs->ent[i], &sp->ent[i]);
+  gs->ai = sp->ai;
+  gs->ev.n = 0;
+}
+
+// 0 if both snapshots hold the same state.
+int
+snap_compare(const snap_t *a, const snap_t *b) {
+  return memcmp(a, b, sizeof(snap_t));
+}
+
+// Serialized form: the counters and the item planes as little endian
+// 32 bit words, then the entities and the ghost AI, all in struct
+// order. Field by field: the layout on disk must not depend on the
+// compiler's.
+void
+snap_put(uint8_t *p, const snap_t *sp) {
+  uint32_t w;
+
+  put_le32(p + 0, sp->seed);
+  put_le32(p + 4, sp->hiscore);
+  put_le32(p + 8, sp->score);
+  put_le32(p + 12, sp->lives);
+  put_le32(p + 16, sp->gamlev);
+  put_le32(p + 20, sp->bonus);
+  put_le32(p + 24, sp->suptim);
+  put_le32(p + 28, sp->serialno);
+  put_le32(p + 32, sp->gm_cur);
+  put_le32(p + 36, sp->gm_prv);
+  put_le32(p + 40, sp->gm_timer_en);
+  put_le32(p + 44, sp->gm_seqno);
+  put_le32(p + 48, sp->gm_timer);
+  put_le32(p + 52, sp->fright_timer);
+  put_le32(p + 56, sp->over);
+  put_le32(p + 60, sp->tick);
+  p += 4 * SNAP_NCOUNTER;
+  for (w = 0; w < BBWORDS; w++) {
+    put_le32(p + 4 * w, sp->bb_cross[w]);
+    put_le32(p + 4 * (BBWORDS + w), sp->bb_pellet[w]);
+  }
+  memcpy(p + 8 * BBWORDS, sp->ent, sizeof(sp->ent));
+  p[8 * BBWORDS + sizeof(sp->ent)] = sp->ai;
+}
+
+void
+snap_get(const uint8_t *p, snap_t *sp) {
+  uint32_t w;
+
+  sp->seed = get_le32(p + 0);
+  sp->hiscore = get_le32(p + 4);
+  sp->score = get_le32(p + 8);
+  sp->lives = get_le32(p + 12);
+  sp->gamlev = get_le32(p + 16);
+  sp->bonus = get_le32(p + 20);
+  sp->suptim = get_le32(p + 24);
+  sp->serialno = get_le32(p + 28);
+  sp->gm_cur = get_le32(p + 32);
+  sp->gm_prv = get_le32(p + 36);
+  sp->gm_timer_en = get_le32(p + 40);
+  sp->gm_seqno = get_le32(p + 44);
+  sp->gm_timer = get_le32(p + 48);
+  sp->fright_timer = get_le32(p + 52);
+  sp->over = get_le32(p + 56);
+  sp->tick = get_le32(p + 60);
+  p += 4 * SNAP_NCOUNTER;
+  for (w = 0; w < BBWORDS; w++) {
+    sp->bb_cross[w] = get_le32(p + 4 * w);
+    sp->bb_pellet[w] = get_le32(p + 4 * (BBWORDS + w));
+  }
+  memcpy(sp->ent, p + 8 * BBWORDS, sizeof(sp->ent));
+  sp->ai = p[8 * BBWORDS + sizeof(sp->ent)];
+  memset(sp->spare, 0, sizeof(sp->spare));
+}
@@ -0,0 +1,296 @@
+#ifndef PMCORE_H
+#define PMCORE_H
+
+#include <stdint.h>
+
+// Pacman game rules. No terminal I/O, no clock, no globals: the
+// whole state of a game lives in a game_t and game_step() advances
+// it by one clock cycle. Read-only tables shared by many games are
+// the caller's, passed by pointer. What happened during that cycle, as far
+// as a renderer is concerned, is reported as a list of events.
+// The interactive game (pacman.c) and the headless one (pmsim.c)
+// share this code, so that they evolve identically given the same
+// input.
+
+#define CLKPERIOD 170  // Expressed in milliseconds
+#define NGHOST 4
+#define NENTITY (1+NGHOST)
+
+// A clock cycle count during which PM stays "supercharged."
+#define SUPER_CLKCYCLES 121
+
+// ------------------------------------------------------------
+// Grid specification.
+
+#define NCOL 33
+#define NROW 23
+#define GRIDSIZE (NCOL * NROW)
+#define NITEM 172     // The total number of collectible items
+
+// Bitboards: one bit per grid cell, bit 'cell & 31' of word 'cell >> 5'.
+#define BBWORDS ((GRIDSIZE + 31) / 32)
+#define BB_TEST(bb, cell) ((bb)[(cell) >> 5] >> ((cell) & 31) & 1)
+#define BB_SET(bb, cell) ((bb)[(cell) >> 5] |= 1u << ((cell) & 31))
+#define BB_CLR(bb, cell) ((bb)[(cell) >> 5] &= ~(1u << ((cell) & 31)))
+
+// ------------------------------------------------------------
+// Well known symbols.
+#define door   ((uint8_t)'T')
+#define cross  ((uint8_t)'K')
+#define pellet ((uint8_t)'L')
+
+// Ghost mode enumeration.
+typedef enum ghostmode_t {
+  mode_scatter,
+  mode_chase,
+  mode_fright,
+  mode_unspec
+} ghostmode_t;
+
+// We define this enumeration so that opposite(dir) is
+// dir 2 + 3 AND (modulo 4) for dir in [0..3].
+typedef enum dir_t {
+  dir_up,
+  dir_left,
+  dir_down,
+  dir_right,
+  dir_blocked,                           // Must be 1 + dir_right
+  dir_unspec,                            // Invalid except for idir (pacman)
+  dir_quit                               // Inv. exc. as retval/pacman.dirselect
+} dir_t;
+
+// ------------------------------------------------------------
+// Animation objects.
+
+// PM is entity #0, the ghosts follow. There are no per-entity
+// methods: game_step() moves them in order and they are told apart
+// by 'inum'. Fields are grouped by how often they are used, so that
+// what a clock cycle touches shares as few cache lines as possible.
+// Caution here: some of the 8 bit fields may have to be signed!
+typedef struct entity {
+  // Every clock cycle, every entity.
+  uint8_t vrown;    // Virtual row number
+  uint8_t pcoln;    // Physical column number
+  uint8_t cdir;     // Current direction
+  uint8_t pdir;     // Previous direction
+  uint8_t glyph;    // Sprite grid character. 0 if not displayed
+  uint8_t inum;     // Instance serial number
+  uint8_t resurr;   // # Clock ticks till we're back (ghosts)
+  uint8_t revflg;   // Reverse direction directive (ghosts)
+  uint8_t hcvrn;    // Home corner vrow# (ghosts, scatter mode)
+  uint8_t hcpcn;    // Home corner pcol# (ghosts, scatter mode)
+  uint8_t idir;     // Intended direction (PM)
+  uint8_t gobbling; // # Clock ticks till we're fed (PM)
+
+  // Level entry, deaths and ghost kills only.
+  uint8_t reward;   // # points for killing a ghost / 100 (PM)
+  uint8_t inited;   // TRUE if first display has been performed
+  uint8_t pcol0;    // Initial pcol number
+  uint8_t vrow0;    // Initial vrow number
+  uint8_t dir0;     // Initial direction
+} entity;
+
+// ------------------------------------------------------------
+// Events. The counters themselves are read from the game_t.
+
+typedef enum evtype_t {
+  ev_score,                      // score changed
+  ev_lives,                      // lives changed
+  ev_level,                      // gamlev changed, new grid
+  ev_suptim,                     // suptim changed
+  ev_bell,                       // Ghosts reversing direction
+  ev_death,                      // PM died. See below
+  ev_gameover                    // No lives left. Stop stepping
+} evtype_t;
+
+#define EVMAX 32                 // Per clock cycle. Plenty
+#define NDEATHFRAME 16           // 4 self rotations
+
+// A sprite, as painted by the compositor.
+typedef struct sprite_t {
+  uint8_t vrown;
+  uint8_t pcoln;
+  uint8_t glyph;                 // 0 if not displayed
+} sprite_t;
+
+typedef struct evlist_t {
+  uint32_t n;
+  uint8_t ev[EVMAX];             // evtype_t values, in order
+
+  // ev_death: the sprites at the time of death, then PM's glyph
+  // for each frame of the dying animation. The game_t itself has
+  // already moved on to the post mortem state.
+  sprite_t death_sprite[NENTITY];
+  uint8_t death_glyph[NDEATHFRAME];
+} evlist_t;
+
+// ------------------------------------------------------------
+// Ghost AI.
+
+// How ghosts head for their target tile, a rule of each game: see
+// game_set_ghostai(). ai_euclid is the arcade's, the neighbour tile
+// closest to the target as the crow flies. ai_maze takes the
+// neighbour tile with the shortest path to it instead.
+typedef enum ghostai_t {
+  ai_euclid,
+  ai_maze
+} ghostai_t;
+
+// All-pairs maze distances, for ai_maze. Tiles are the cells that
+// are not walls, the pen and its door included, numbered in cell
+// order. The maze is the same at every level and in every game:
+// one table, built by mazedist_build(), serves any number of games,
+// which only read it.
+typedef struct mazedist_t {
+  uint32_t ntile;
+  uint16_t tile[GRIDSIZE];       // Tile # of a cell, the nearest for walls
+  uint8_t *d;                    // ntile rows of ntile, in tiles
+} mazedist_t;
+
+#define MAZEDIST_INF 255         // Unreachable
+
+// ------------------------------------------------------------
+// Game state.
+
+typedef struct game_t {
+  uint16_t seed;                 // Must be NZ on first use!
+  uint32_t hiscore;
+  uint32_t score;
+  uint32_t lives;
+  uint32_t gamlev;
+  uint32_t bonus;
+  uint32_t suptim;
+  uint32_t serialno;             // Instance number generator.
+
+  uint32_t gm_cur;               // Current ghost mode
+  uint32_t gm_prv;               // Previous ghost mode
+  int32_t gm_timer_en;
+  uint32_t gm_seqno;
+  uint32_t gm_timer;
+  uint32_t fright_timer;
+
+  uint32_t over;                 // TRUE once the game is over
+  uint32_t tick;                 // # game_step() calls
+  uint32_t ai;                   // Ghost AI: ghostai_t
+  const mazedist_t *md;          // Shared, read only. NULL if unused
+
+  // The maze, as bit planes. Walls, door and pen are the same at
+  // every level, crosses and pellets are those left to eat. All
+  // zero until the first level entry. The glyphs are only derived
+  // for rendering: see game_grid().
+  uint32_t bb_wall[BBWORDS];
+  uint32_t bb_cross[BBWORDS];
+  uint32_t bb_pellet[BBWORDS];
+  uint32_t bb_door[BBWORDS];
+  uint32_t bb_pen[BBWORDS];
+  uint32_t bb_cross0[BBWORDS];   // Items at level entry
+  uint32_t bb_pellet0[BBWORDS];
+
+  uint32_t maze_ok;              // TRUE once the planes hold the maze
+  uint8_t exits[GRIDSIZE];       // Exit masks, derived from the planes
+  entity ent[NENTITY];           // The entity vector, PM first
+  evlist_t ev;                   // What the last step did
+} game_t;
+
+#define PACMAN_ADDR (&gs->ent[0])
+
+// Exit masks. For every tile, bit 'dir' is set if an entity there
+// may move in direction 'dir'. The low nibble is PM's, the high
+// nibble the ghosts'. The pen door only lets ghosts out, so the two
+// differ on the pen tiles below it. Walls never move within a level
+// and eaten items leave passable blanks, so the masks are built with
+// the planes and only depend on the maze.
+#define EXITS_PM(x) ((x) & 0x0F)
+#define EXITS_GHOST(x) ((x) >> 4)
+
+// ------------------------------------------------------------
+// Snapshots. Everything game_step() reads or writes, bar the event
+// list and what only depends on the maze (the distance table too),
+// in one fixed-layout struct: no pointers, no padding. It can be
+// copied with memcpy(), compared with memcmp() and kept in any
+// number for rollback or lookahead. The serialized form (SNAPSIZE
+// bytes, little endian) is stable across hosts and builds.
+
+// An entity, fields in their original order (that of the digest).
+typedef struct entsnap_t {
+  uint8_t resurr;
+  uint8_t reward;
+  uint8_t vrown;
+  uint8_t pcoln;
+  uint8_t glyph;
+  uint8_t pcol0;
+  uint8_t vrow0;
+  uint8_t dir0;
+  uint8_t hcvrn;
+  uint8_t hcpcn;
+  uint8_t cdir;
+  uint8_t pdir;
+  uint8_t idir;
+  uint8_t revflg;
+  uint8_t inited;
+  uint8_t gobbling;
+  uint8_t inum;
+} entsnap_t;
+
+typedef struct snap_t {
+  uint32_t seed;                 // game_t counters, same order
+  uint32_t hiscore;
+  uint32_t score;
+  uint32_t lives;
+  uint32_t gamlev;
+  uint32_t bonus;
+  uint32_t suptim;
+  uint32_t serialno;
+  uint32_t gm_cur;
+  uint32_t gm_prv;
+  uint32_t gm_timer_en;          // int32_t in the game_t
+  uint32_t gm_seqno;
+  uint32_t gm_timer;
+  uint32_t fright_timer;
+  uint32_t over;
+  uint32_t tick;
+
+  uint32_t bb_cross[BBWORDS];    // Items left, as in the game_t
+  uint32_t bb_pellet[BBWORDS];
+  entsnap_t ent[NENTITY];
+  uint8_t ai;                    // game_t.ai
+  uint8_t spare[2];              // Zero. Not serialized
+} snap_t;
+
+#define SNAP_NCOUNTER 16
+#define SNAPSIZE (4 * SNAP_NCOUNTER + 8 * BBWORDS + NENTITY * 17 + 1)
+
+// ------------------------------------------------------------
+// Interface.
+
+void game_init(game_t *gs);
+void game_free(game_t *gs);
+const evlist_t *game_step(game_t *gs, uint8_t input);
+uint32_t game_digest(game_t *gs);
+uint32_t game_nremitem(game_t *gs);
+void game_grid(game_t *gs, uint8_t *grid);
+void game_set_ghostai(game_t *gs, ghostai_t ai, const mazedist_t *md);
+void mazedist_build(mazedist_t *md);
+void mazedist_free(mazedist_t *md);
+uint32_t mazedist_target(const mazedist_t *md, int8_t tvr, int8_t tpc);
+
+void game_snapshot(game_t *gs, snap_t *sp);
+void game_restore(game_t *gs, const snap_t *sp);
+int snap_compare(const snap_t *a, const snap_t *b);
+void snap_put(uint8_t *p, const snap_t *sp);
+void snap_get(const uint8_t *p, snap_t *sp);
+
+// Rule helpers, also used by the lockstep engine (pmlock.c).
+int32_t gm_timer_initval_get(uint8_t level, uint8_t seqno);
+dir_t ghost_dirselect(game_t *gs, entity *self);
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *p, uint32_t len);
+uint32_t crc32(const uint8_t *p, uint32_t len);
+void put_le32(uint8_t *p, uint32_t val);
+uint32_t get_le32(const uint8_t *p);
+
+// Supplied by the front end. Called upon violated assumptions.
+// Does not return.
+void crash_and_burn(char *errmsg);
+
+#endif                                   // PMCORE_H
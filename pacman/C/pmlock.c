@@ -0,0 +1,821 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pmlock.h"
+
+// Lockstep engine. See pmlock.h. Every routine here mirrors its
+// pmcore.c namesake, lane 'l' standing for the game_t.
+
+// ------------------------------------------------------------
+// Lane by lane helpers.
+
+uint16_t
+lk_prandom(lock_t *lk, uint32_t l) {
+  uint16_t seed = lk->seed[l];
+
+  seed ^= seed << 7;
+  seed ^= seed >> 9;
+  seed ^= seed << 8;
+  return lk->seed[l] = seed;
+}
+
+// level_cleared().
+uint32_t
+lk_level_cleared(lock_t *lk, uint32_t l) {
+  uint32_t w, any = 0;
+
+  for (w = 0; w < BBWORDS; w++)
+    any |= lk->item[l][w];
+  return !any;
+}
+
+void
+lk_reset_coords_and_dir(lock_t *lk, uint32_t e, uint32_t l) {
+  lk->cdir[e][l] = lk->dir0[e];
+  lk->vrown[e][l] = lk->vrow0[e];
+  lk->pcoln[e][l] = lk->pcol0[e];
+}
+
+void
+lk_entity_display(lock_t *lk, uint32_t e, uint32_t l) {
+  uint8_t seldir;
+
+  if (e) {
+    lk->glyph[e][l] = (lk->fright_timer[l] ? "[\\]^" : "NXYZ")[e - 1];
+    return;
+  }
+
+  if (lk->gobbling[0][l]) {
+    lk->gobbling[0][l]--;
+    lk->glyph[0][l] = 'R';
+    return;
+  }
+
+  seldir = lk->cdir[0][l] == dir_blocked ? lk->pdir[0][l] : lk->cdir[0][l];
+  switch (seldir) {
+    case dir_right:
+      lk->glyph[0][l] = 'M';
+      return;
+    case dir_left:
+      lk->glyph[0][l] = 'U';
+      return;
+    case dir_up:
+      lk->glyph[0][l] = 'V';
+      return;
+    case dir_down:
+      lk->glyph[0][l] = 'W';
+      return;
+  }
+  crash_and_burn("lk_entity_display: invalid current direction");
+}
+
+// ------------------------------------------------------------
+// Ghost mode logic.
+
+ghostmode_t
+lk_gm_getnext(lock_t *lk, uint32_t l) {
+  int32_t ncycles;
+
+  lk->gm_timer_en[l] = ncycles =
+    gm_timer_initval_get(lk->gamlev[l], lk->gm_seqno[l]);
+  if (ncycles != (int32_t)-1) {
+    lk->gm_timer[l] = ncycles;
+    return lk->gm_seqno[l] & 1 ? mode_chase : mode_scatter;
+  }
+
+  return mode_chase;
+}
+
+void
+lk_gm_prv_update(lock_t *lk, uint32_t l) {
+  if (lk->gm_cur[l] != mode_fright)
+    lk->gm_prv[l] = lk->gm_cur[l];
+}
+
+void
+lk_gm_allghosts_reverse(lock_t *lk, uint32_t l) {
+  uint32_t e;
+
+  for (e = 1; e < NENTITY; e++)
+    lk->revflg[e][l] = 1;
+}
+
+void
+lk_gm_switchto(lock_t *lk, uint32_t l, ghostmode_t mode) {
+  if (mode == lk->gm_cur[l])
+    return;
+
+  if (lk->gm_cur[l] != mode_fright)
+    lk_gm_allghosts_reverse(lk, l);
+
+  lk_gm_prv_update(lk, l);
+  lk->gm_cur[l] = mode;
+}
+
+void
+lk_super_enter(lock_t *lk, uint32_t l) {
+  lk_gm_allghosts_reverse(lk, l);
+
+  if (lk->gm_cur[l] == mode_fright) {
+    lk->fright_timer[l] = SUPER_CLKCYCLES;
+    return;
+  }
+
+  lk_gm_prv_update(lk, l);
+  lk->gm_cur[l] = mode_fright;
+  lk->gm_timer_en[l] = 0;
+  lk->fright_timer[l] = SUPER_CLKCYCLES;
+}
+
+void
+lk_super_leave(lock_t *lk, uint32_t l) {
+  lk->reward[0][l] = 0;
+  lk_gm_switchto(lk, l, lk->gm_prv[l]);
+  lk->gm_timer_en[l] = -1;
+}
+
+void
+lk_gm_handle(lock_t *lk, uint32_t l) {
+  if (lk->gm_cur[l] == mode_fright) {
+    if (lk->fright_timer[l]) {
+      lk->fright_timer[l]--;
+      lk->suptim[l] += CLKPERIOD / 5;
+    }
+    else
+      lk_super_leave(lk, l);
+  }
+  else if (lk->gm_timer_en[l]) {
+    if (lk->gm_timer[l])
+      lk->gm_timer[l]--;
+    else {
+      lk->gm_seqno[l] = lk->gm_seqno[l] < 6 ? 1 + lk->gm_seqno[l] : 7;
+      lk_gm_switchto(lk, l, lk_gm_getnext(lk, l));
+    }
+  }
+}
+
+// dot_initial_grid(), update_level() and level_entry_inits().
+void
+lk_level_entry(lock_t *lk, uint32_t l) {
+  uint32_t e, w;
+
+  for (w = 0; w < BBWORDS; w++)
+    lk->item[l][w] = lk->gs0.bb_cross0[w] | lk->gs0.bb_pellet0[w];
+  lk->gamlev[l]++;
+
+  lk->reward[0][l] = 0;
+  for (e = 0; e < NENTITY; e++) {
+    lk_reset_coords_and_dir(lk, e, l);
+    lk->inited[e][l] = 0;
+    lk->glyph[e][l] = 0;
+  }
+
+  lk->seed[l] = 23741;
+  lk->fright_timer[l] = 0;
+  lk->gm_seqno[l] = 0;
+  lk->gm_cur[l] = lk_gm_getnext(lk, l);
+  lk->gm_prv[l] = mode_unspec;
+}
+
+// ------------------------------------------------------------
+// Direction selection.
+
+// Kernel: pack the lanes of 'm' where entity 'e' stands on even
+// coordinates, the only ones where anything but moving on can
+// happen. Returns their count.
+uint32_t
+lk_pack(lock_t *lk, uint32_t e, const uint8_t *m, uint16_t *idx) {
+  uint32_t l, n = 0;
+
+  for (l = 0; l < lk->nlane; l++) {
+    idx[n] = l;
+    n += m[l] & !((lk->vrown[e][l] | lk->pcoln[e][l]) & 1);
+  }
+  return n;
+}
+
+// Kernel: pacman_dirselect() on the lanes of 'm' where PM stands on
+// even coordinates. The intended direction wins if it is open, then
+// the current one; else PM stops and remembers it.
+void
+lk_pacman_dirselect(lock_t *lk, const uint8_t *m) {
+  const uint8_t *exits = lk->gs0.exits;
+  uint16_t idx[LOCK_MAXLANE];
+  uint8_t x, i, c, oki, okc;
+  uint32_t j, l, n;
+
+  n = lk_pack(lk, 0, m, idx);
+  for (j = 0; j < n; j++) {
+    l = idx[j];
+    x = EXITS_PM(exits[NCOL * (lk->vrown[0][l] >> 1) +
+      (lk->pcoln[0][l] >> 1)]);
+    i = lk->idir[0][l];                  // < dir_blocked or dir_unspec
+    c = lk->cdir[0][l];                  // <= dir_blocked
+    oki = (i < dir_blocked) & (x >> (i & 3));
+    okc = (c < dir_blocked) & (x >> (c & 3));
+    lk->idir[0][l] = oki ? dir_unspec : i;
+    lk->pdir[0][l] = !oki && !okc && c < dir_blocked ? c : lk->pdir[0][l];
+    lk->cdir[0][l] = oki ? i : okc ? c : dir_blocked;
+  }
+}
+
+dir_t
+lk_ghost_dirselect_fright(lock_t *lk, uint32_t l, uint32_t bitmap) {
+  uint8_t bit0;
+  dir_t dir;
+
+  for (dir = dir_up; dir < dir_blocked; dir++) {
+    bit0 = bitmap & 1;
+    bitmap >>= 1;
+    if (bit0) {
+      if (bitmap) {
+        if (lk_prandom(lk, l) & 8)
+          return dir;
+      }
+      else
+        return dir;
+    }
+  }
+
+  crash_and_burn("lk_ghost_dirselect_fright: no viable direction found");
+  return dir_down;
+}
+
+// Chase mode target of ghost 'e' (Blinky, Pinky or Inky).
+void
+lk_chase_target(lock_t *lk, uint32_t e, uint32_t l, int8_t *tvr,
+  int8_t *tpc) {
+  int8_t pcol, vrow, dist;
+  uint8_t dir;
+
+  vrow = (int8_t)lk->vrown[0][l];
+  pcol = (int8_t)lk->pcoln[0][l];
+  if (e == 1) {
+    *tvr = vrow;
+    *tpc = pcol;
+    return;
+  }
+
+  dist = e == 2 ? 8 : 4;
+  dir = lk->cdir[0][l] != dir_blocked ? lk->cdir[0][l] : lk->pdir[0][l];
+  switch (dir) {
+    case dir_left:
+      pcol -= dist;
+      break;
+    case dir_right:
+      pcol += dist;
+      break;
+    case dir_up:
+      vrow -= dist;
+      break;
+    case dir_down:
+      vrow += dist;
+      break;
+    default:
+      crash_and_burn("lk_chase_target: PM's current direction not "
+        "recognized");
+  }
+  if (e == 2) {
+    *tvr = vrow;
+    *tpc = pcol;
+    return;
+  }
+
+  // Inky: twice the vector from Blinky.
+  vrow = 2 * (vrow - lk->vrown[1][l]);
+  pcol = 2 * (pcol - lk->pcoln[1][l]);
+  *tvr = lk->vrown[1][l] + vrow;
+  *tpc = lk->pcoln[1][l] + pcol;
+}
+
+// Kernel: ghost_dirselect_nav2target() on 'n' packed requests,
+// from [vr, pc] to [tvr, tpc] through the directions of 'bm'. The
+// four squared distances are truncated to 16 bits, as in the
+// original. The direction goes to 'dir', dir_blocked meaning that
+// no minimum was found.
+void
+lk_nav2target(uint32_t n, const uint8_t *vr, const uint8_t *pc,
+  const uint8_t *bm, const int8_t *tvr, const int8_t *tpc, uint8_t *dir) {
+  int16_t dx, dy;
+  uint16_t d, minval;
+  uint8_t dirmin, t;
+  uint32_t j;
+
+  for (j = 0; j < n; j++) {
+    minval = 65535;
+    dirmin = dir_blocked;
+
+    dx = (int8_t)pc[j] - tpc[j];         // dir_up
+    dy = (int8_t)vr[j] - 1 - tvr[j];
+    d = dx * dx + dy * dy;
+    t = (bm[j] & 1) && d < minval;
+    dirmin = t ? dir_up : dirmin;
+    minval = t ? d : minval;
+
+    dx = (int8_t)pc[j] - 1 - tpc[j];     // dir_left
+    dy = (int8_t)vr[j] - tvr[j];
+    d = dx * dx + dy * dy;
+    t = (bm[j] & 2) && d < minval;
+    dirmin = t ? dir_left : dirmin;
+    minval = t ? d : minval;
+
+    dx = (int8_t)pc[j] - tpc[j];         // dir_down
+    dy = (int8_t)vr[j] + 1 - tvr[j];
+    d = dx * dx + dy * dy;
+    t = (bm[j] & 4) && d < minval;
+    dirmin = t ? dir_down : dirmin;
+    minval = t ? d : minval;
+
+    dx = (int8_t)pc[j] + 1 - tpc[j];     // dir_right
+    dy = (int8_t)vr[j] - tvr[j];
+    d = dx * dx + dy * dy;
+    t = (bm[j] & 8) && d < minval;
+    dir[j] = t ? dir_right : dirmin;
+  }
+}
+
+// Kernel: ghost_dirselect_nav2tile(), the same for ai_maze. The
+// maze distances of the four neighbouring tiles are read from the
+// target tile's row of table 'md'.
+void
+lk_nav2tile(const mazedist_t *md, uint32_t n, const uint8_t *vr,
+  const uint8_t *pc, const uint8_t *bm, const int8_t *tvr, const int8_t *tpc,
+  uint8_t *dir) {
+  const uint8_t *dp;
+  uint32_t j, cell, d, minval;
+  uint8_t dirmin, t;
+
+  for (j = 0; j < n; j++) {
+    dp = md->d + md->ntile * mazedist_target(md, tvr[j], tpc[j]);
+    cell = NCOL * (vr[j] >> 1) + (pc[j] >> 1);
+    minval = MAZEDIST_INF + 1;
+    dirmin = dir_blocked;
+
+    d = dp[md->tile[cell - NCOL]];  // dir_up
+    t = (bm[j] & 1) && d < minval;
+    dirmin = t ? dir_up : dirmin;
+    minval = t ? d : minval;
+
+    d = dp[md->tile[cell - 1]];     // dir_left
+    t = (bm[j] & 2) && d < minval;
+    dirmin = t ? dir_left : dirmin;
+    minval = t ? d : minval;
+
+    d = dp[md->tile[cell + NCOL]];  // dir_down
+    t = (bm[j] & 4) && d < minval;
+    dirmin = t ? dir_down : dirmin;
+    minval = t ? d : minval;
+
+    d = dp[md->tile[cell + 1]];     // dir_right
+    t = (bm[j] & 8) && d < minval;
+    dir[j] = t ? dir_right : dirmin;
+  }
+}
+
+// Kernel: the forced part of ghost_dirselect(), on the 'n' lanes of
+// 'idx', where ghost 'e' stands on even coordinates: the reversal
+// request is consumed and, when the exits leave no choice, the new
+// direction set. The lanes that still have to choose are packed
+// into 'cidx', with their viable directions in 'cbm'. Returns their
+// count.
+uint32_t
+lk_ghost_forced(lock_t *lk, uint32_t e, uint32_t n, const uint16_t *idx,
+  uint16_t *cidx, uint8_t *cbm) {
+  // The only direction of a bitmap, dir_blocked if none or several.
+  static const uint8_t onedir[16] = {
+    dir_blocked, dir_up, dir_left, dir_blocked,
+    dir_down, dir_blocked, dir_blocked, dir_blocked,
+    dir_right, dir_blocked, dir_blocked, dir_blocked,
+    dir_blocked, dir_blocked, dir_blocked, dir_blocked
+  };
+  const uint8_t *exits = lk->gs0.exits;
+  uint8_t vr, pc, cdir, r, b, pen, dir;
+  uint32_t j, l, k = 0;
+
+  for (j = 0; j < n; j++) {
+    l = idx[j];
+    vr = lk->vrown[e][l];
+    pc = lk->pcoln[e][l];
+    cdir = lk->cdir[e][l];
+    r = lk->revflg[e][l];
+    lk->revflg[e][l] = 0;
+
+    b = r ? 0x0F : 0x0F & ~(1 << ((cdir + 2) & 3));
+    b &= EXITS_GHOST(exits[NCOL * (vr >> 1) + (pc >> 1)]);
+
+    // In the pen, stick to an open current direction. Then honor
+    // reversal requests.
+    pen = (vr >= 16) & (vr < 23) & (pc >= 30) & (pc < 35) & (b >> cdir);
+    dir = pen ? cdir : r ? (cdir + 2) & 3 : onedir[b];
+    lk->cdir[e][l] = dir;
+
+    cidx[k] = l;
+    cbm[k] = b;
+    k += dir == dir_blocked;
+  }
+  return k;
+}
+
+// ghost_dirselect() for ghost 'e' on all the lanes of 'm'. Ghosts
+// only choose on even coordinates and most choices are forced, so
+// the lanes are packed three times: those on even coordinates,
+// those with a choice, then those that navigate to a target.
+void
+lk_ghost_dirselect(lock_t *lk, uint32_t e, const uint8_t *m) {
+  uint8_t cbm[LOCK_MAXLANE];
+  uint8_t nvr[LOCK_MAXLANE], npc[LOCK_MAXLANE], nbm[LOCK_MAXLANE];
+  uint8_t ndir[LOCK_MAXLANE];
+  int8_t tvr[LOCK_MAXLANE], tpc[LOCK_MAXLANE];
+  uint16_t idx[LOCK_MAXLANE], cidx[LOCK_MAXLANE], nidx[LOCK_MAXLANE];
+  uint32_t l, j, nchoice, n = 0;
+
+  nchoice = lk_pack(lk, e, m, idx);
+  nchoice = lk_ghost_forced(lk, e, nchoice, idx, cidx, cbm);
+
+  // Frightened ghosts, and Clyde when chasing, pick at random.
+  for (j = 0; j < nchoice; j++) {
+    l = cidx[j];
+    if (lk->gm_cur[l] == mode_scatter) {
+      tvr[n] = (int8_t)lk->hcvrn[e];
+      tpc[n] = (int8_t)lk->hcpcn[e];
+    }
+    else if (lk->gm_cur[l] == mode_chase && e != 4)
+      lk_chase_target(lk, e, l, &tvr[n], &tpc[n]);
+    else if (lk->gm_cur[l] == mode_chase || lk->gm_cur[l] == mode_fright) {
+      lk->cdir[e][l] = lk_ghost_dirselect_fright(lk, l, cbm[j]);
+      continue;
+    }
+    else
+      crash_and_burn("lk_ghost_dirselect: unsupported ghost mode");
+    nidx[n] = l;
+    nvr[n] = lk->vrown[e][l];
+    npc[n] = lk->pcoln[e][l];
+    nbm[n++] = cbm[j];
+  }
+  if (!n)
+    return;
+
+  if (lk->gs0.ai == ai_maze)
+    lk_nav2tile(lk->gs0.md, n, nvr, npc, nbm, tvr, tpc, ndir);
+  else
+    lk_nav2target(n, nvr, npc, nbm, tvr, tpc, ndir);
+  for (j = 0; j < n; j++) {
+    if (ndir[j] == dir_blocked)
+      crash_and_burn("lk_nav2target: no minimum found");
+    lk->cdir[e][nidx[j]] = ndir[j];
+  }
+}
+
+// ------------------------------------------------------------
+// Eating, collisions.
+
+// pacman_moving_policy() on the lanes of 'm' where PM has just
+// landed on even coordinates. The lanes where there is something to
+// eat are packed first.
+void
+lk_pacman_eat(lock_t *lk, const uint8_t *m) {
+  uint16_t idx[LOCK_MAXLANE], eidx[LOCK_MAXLANE];
+  uint32_t j, k = 0, l, n, cell, out, bad = 0;
+  uint8_t vr, pc;
+
+  n = lk_pack(lk, 0, m, idx);
+  for (j = 0; j < n; j++) {
+    l = idx[j];
+    vr = lk->vrown[0][l];
+    pc = lk->pcoln[0][l];
+    out = (vr < 2) | (vr >= 44) | (pc < 2) | (pc >= 64);
+    cell = out ? 0 : NCOL * (vr >> 1) + (pc >> 1);
+    bad |= out;
+    eidx[k] = l;
+    k += BB_TEST(lk->item[l], cell);
+  }
+  if (bad)
+    crash_and_burn("lk_pacman_eat: out of bounds");
+
+  for (j = 0; j < k; j++) {
+    l = eidx[j];
+    cell = NCOL * (lk->vrown[0][l] >> 1) + (lk->pcoln[0][l] >> 1);
+    lk->gobbling[0][l] = 2;
+    if (BB_TEST(lk->gs0.bb_pellet0, cell)) {
+      lk->score[l] += 50;
+      lk_super_enter(lk, l);
+    }
+    else
+      lk->score[l] += 10;
+    BB_CLR(lk->item[l], cell);
+  }
+}
+
+// collision_handle() and pacman_dying_routine().
+void
+lk_collision_handle(lock_t *lk, uint32_t l, uint32_t g) {
+  uint32_t e;
+
+  if (lk->fright_timer[l]) {
+    if (!lk->resurr[g][l]) {
+      lk->resurr[g][l] = 50;
+      lk->reward[0][l] = lk->reward[0][l] ? lk->reward[0][l] * 2 : 2;
+      lk->score[l] += 100 * (uint32_t)lk->reward[0][l];
+      lk_reset_coords_and_dir(lk, g, l);
+    }
+    return;
+  }
+
+  // PM dies. The dying animation cycles PM's sprite 16 times,
+  // which is enough for any gobbling to be over.
+  lk->gobbling[0][l] = lk->gobbling[0][l] > NDEATHFRAME ?
+    lk->gobbling[0][l] - NDEATHFRAME : 0;
+  lk->fright_timer[l] = 0;
+  lk->reward[0][l] = 0;
+  for (e = 0; e < NENTITY; e++) {
+    lk->glyph[e][l] = 0;
+    if (e)
+      lk->resurr[e][l] = 20;
+    lk_reset_coords_and_dir(lk, e, l);
+    lk->inited[e][l] = 0;
+  }
+
+  if (!--lk->lives[l])
+    lk->over[l] = 1;
+}
+
+// ------------------------------------------------------------
+// entity_move() for slot 'e', on all the lanes of 'run'. Lanes
+// whose game ends are removed from 'run'.
+
+void
+lk_entity_move(lock_t *lk, uint32_t e, uint8_t *run) {
+  uint8_t *m = lk->move, hit[LOCK_MAXLANE];
+  uint8_t (*vr)[LOCK_MAXLANE] = lk->vrown, (*pcol)[LOCK_MAXLANE] = lk->pcoln;
+  uint32_t l, n = lk->nlane, bad = 0, nnew = 0;
+  uint8_t r, c, g, go, pr, pc, h, nhit = 0, plain, fright;
+
+  // First display. It takes the whole step.
+  for (l = 0; l < n; l++) {
+    m[l] = run[l] & lk->inited[e][l];
+    nnew += run[l] & !lk->inited[e][l];
+  }
+  for (l = 0; nnew && l < n; l++)
+    if (run[l] && !lk->inited[e][l]) {
+      lk_entity_display(lk, e, l);
+      lk->inited[e][l] = 1;
+    }
+
+  for (l = 0; l < n; l++) {
+    c = lk->cdir[e][l];
+    bad |= m[l] & ((c > dir_blocked) | ((c == dir_blocked) & (e != 0)));
+  }
+  if (bad)
+    crash_and_burn("lk_entity_move: illegal current direction");
+
+  if (e)
+    lk_ghost_dirselect(lk, e, m);
+  else
+    lk_pacman_dirselect(lk, m);
+
+  // Kernel: new coordinates. Eating only depends on where PM lands,
+  // so the coordinates are updated first.
+  for (l = 0; l < n; l++) {
+    r = lk->resurr[e][l];
+    c = lk->cdir[e][l];
+    go = m[l] && !r;
+    lk->pcoln[e][l] += go ? (c == dir_right) - (c == dir_left) : 0;
+    lk->vrown[e][l] += go ? (c == dir_down) - (c == dir_up) : 0;
+    lk->resurr[e][l] = r - (m[l] && r);
+  }
+
+  if (!e)
+    lk_pacman_eat(lk, m);
+
+  // Kernel: collision tests. 'e' itself first, then the ghosts in
+  // entity vector order.
+  for (l = 0; l < n; l++) {
+    pr = vr[0][l] >> 1;
+    pc = pcol[0][l] >> 1;
+    h = ((vr[4][l] >> 1) == pr) & ((pcol[4][l] >> 1) == pc) ? 4 : 0;
+    h = ((vr[3][l] >> 1) == pr) & ((pcol[3][l] >> 1) == pc) ? 3 : h;
+    h = ((vr[2][l] >> 1) == pr) & ((pcol[2][l] >> 1) == pc) ? 2 : h;
+    h = ((vr[1][l] >> 1) == pr) & ((pcol[1][l] >> 1) == pc) ? 1 : h;
+    h = ((vr[e][l] >> 1) == pr) & ((pcol[e][l] >> 1) == pc) & (e != 0) ?
+      e : h;
+    hit[l] = m[l] ? h : 0;
+    nhit |= hit[l];
+  }
+
+  for (l = 0; nhit && l < n; l++)
+    if (hit[l]) {
+      lk_collision_handle(lk, l, hit[l]);
+      if (lk->over[l])
+        m[l] = run[l] = 0;
+    }
+
+  // Display. For a ghost this is a plain select.
+  if (e) {
+    plain = "NXYZ"[e - 1];
+    fright = "[\\]^"[e - 1];
+    for (l = 0; l < n; l++) {
+      g = lk->fright_timer[l] ? fright : plain;
+      lk->glyph[e][l] = m[l] ? g : lk->glyph[e][l];
+    }
+  }
+  else {
+    for (l = 0; l < n; l++) {
+      r = lk->gobbling[0][l];
+      c = lk->cdir[0][l];
+      g = lk->pdir[0][l];                // Facing that way if blocked
+      c = c == dir_blocked ? g : c;
+      bad |= m[l] & (c >= dir_blocked);
+      g = c == dir_up ? 'V' : 'M';       // Selects, no table: vectorizes
+      g = c == dir_left ? 'U' : g;
+      g = c == dir_down ? 'W' : g;
+      g = r ? 'R' : g;
+      lk->glyph[0][l] = m[l] ? g : lk->glyph[0][l];
+      lk->gobbling[0][l] = r - (m[l] & (r != 0));
+    }
+    if (bad)
+      crash_and_burn("lk_entity_move: invalid current direction");
+  }
+}
+
+// ------------------------------------------------------------
+// Interface.
+
+lock_t *
+lock_new(uint32_t nlane, ghostai_t ai, const mazedist_t *md) {
+  uint32_t e;
+  lock_t *lk;
+  entity *ep;
+
+  if (!nlane || nlane > LOCK_MAXLANE)
+    crash_and_burn("lock_new: invalid lane count");
+  if (!(lk = calloc(sizeof(lock_t), 1)))
+    crash_and_burn("lock_new: calloc returned NULL");
+  lk->nlane = nlane;
+
+  // The maze and the entities' constants are taken from a game
+  // that just entered level #1. Its ghost AI is that of every lane.
+  if (ai == ai_maze && (!md || !md->d))
+    crash_and_burn("lock_new: no distance table");
+  game_init(&lk->gs0);
+  game_set_ghostai(&lk->gs0, ai, md);
+  (void)game_step(&lk->gs0, dir_unspec);
+  for (e = 0; e < NENTITY; e++) {
+    ep = &lk->gs0.ent[e];
+    if (ep->inum != e)
+      crash_and_burn("lock_new: unexpected entity vector");
+    lk->vrow0[e] = ep->vrow0;
+    lk->pcol0[e] = ep->pcol0;
+    lk->dir0[e] = ep->dir0;
+    lk->hcvrn[e] = ep->hcvrn;
+    lk->hcpcn[e] = ep->hcpcn;
+  }
+  return lk;
+}
+
+void
+lock_free(lock_t *lk) {
+  free(lk);
+}
+
+// A new game in 'lane', as left by game_init().
+void
+lock_start(lock_t *lk, uint32_t l) {
+  uint32_t e;
+
+  lk->live[l] = 1;
+  lk->seed[l] = 0;
+  lk->score[l] = 0;
+  lk->lives[l] = 3;
+  lk->gamlev[l] = 0;
+  lk->suptim[l] = 0;
+  lk->gm_cur[l] = mode_scatter;
+  lk->gm_prv[l] = mode_unspec;
+  lk->gm_timer_en[l] = -1;
+  lk->gm_seqno[l] = 0;
+  lk->gm_timer[l] = 0;
+  lk->fright_timer[l] = 0;
+  lk->over[l] = 0;
+  lk->tick[l] = 0;
+  memset(lk->item[l], 0, sizeof(lk->item[l]));
+
+  for (e = 0; e < NENTITY; e++) {
+    lk->resurr[e][l] = 0;
+    lk->reward[e][l] = 0;
+    lk->glyph[e][l] = 0;
+    lk->revflg[e][l] = 0;
+    lk->inited[e][l] = 0;
+    lk->gobbling[e][l] = 0;
+    lk->pdir[e][l] = dir_blocked;
+    lk->idir[e][l] = dir_unspec;
+    lk_reset_coords_and_dir(lk, e, l);
+  }
+}
+
+// Move the game in lane 'src' over to lane 'dst'.
+void
+lock_move(lock_t *lk, uint32_t dst, uint32_t src) {
+  uint32_t e;
+
+  lk->live[dst] = lk->live[src];
+  lk->seed[dst] = lk->seed[src];
+  lk->score[dst] = lk->score[src];
+  lk->lives[dst] = lk->lives[src];
+  lk->gamlev[dst] = lk->gamlev[src];
+  lk->suptim[dst] = lk->suptim[src];
+  lk->gm_cur[dst] = lk->gm_cur[src];
+  lk->gm_prv[dst] = lk->gm_prv[src];
+  lk->gm_timer_en[dst] = lk->gm_timer_en[src];
+  lk->gm_seqno[dst] = lk->gm_seqno[src];
+  lk->gm_timer[dst] = lk->gm_timer[src];
+  lk->fright_timer[dst] = lk->fright_timer[src];
+  lk->over[dst] = lk->over[src];
+  lk->tick[dst] = lk->tick[src];
+  memcpy(lk->item[dst], lk->item[src], sizeof(lk->item[src]));
+
+  for (e = 0; e < NENTITY; e++) {
+    lk->resurr[e][dst] = lk->resurr[e][src];
+    lk->reward[e][dst] = lk->reward[e][src];
+    lk->vrown[e][dst] = lk->vrown[e][src];
+    lk->pcoln[e][dst] = lk->pcoln[e][src];
+    lk->glyph[e][dst] = lk->glyph[e][src];
+    lk->cdir[e][dst] = lk->cdir[e][src];
+    lk->pdir[e][dst] = lk->pdir[e][src];
+    lk->idir[e][dst] = lk->idir[e][src];
+    lk->revflg[e][dst] = lk->revflg[e][src];
+    lk->inited[e][dst] = lk->inited[e][src];
+    lk->gobbling[e][dst] = lk->gobbling[e][src];
+  }
+}
+
+// game_step() on every live lane whose game is not over. 'input'
+// has one direction per lane.
+void
+lock_step(lock_t *lk, const uint8_t *input) {
+  uint8_t run[LOCK_MAXLANE];
+  uint32_t l, e;
+
+  for (l = 0; l < lk->nlane; l++) {
+    if (!(run[l] = lk->live[l] && !lk->over[l]))
+      continue;
+
+    lk->tick[l]++;
+    if (input[l] < dir_blocked)
+      lk->idir[0][l] = input[l];
+
+    if (lk_level_cleared(lk, l)) {
+      lk_level_entry(lk, l);
+      run[l] = 0;
+      continue;
+    }
+    lk_gm_handle(lk, l);
+  }
+
+  for (e = 0; e < NENTITY; e++)
+    lk_entity_move(lk, e, run);
+}
+
+// Copy the game in 'lane' to 'gs'. For game_digest() and the like.
+void
+lock_export(lock_t *lk, uint32_t l, game_t *gs) {
+  uint32_t e, w;
+  entity *ep;
+
+  *gs = lk->gs0;                         // Maze and entity constants
+  gs->seed = lk->seed[l];
+  gs->hiscore = 0;
+  gs->score = lk->score[l];
+  gs->lives = lk->lives[l];
+  gs->gamlev = lk->gamlev[l];
+  gs->bonus = 0;
+  gs->suptim = lk->suptim[l];
+  gs->gm_cur = lk->gm_cur[l];
+  gs->gm_prv = lk->gm_prv[l];
+  gs->gm_timer_en = lk->gm_timer_en[l];
+  gs->gm_seqno = lk->gm_seqno[l];
+  gs->gm_timer = lk->gm_timer[l];
+  gs->fright_timer = lk->fright_timer[l];
+  gs->over = lk->over[l];
+  gs->tick = lk->tick[l];
+  gs->ev.n = 0;
+
+  for (w = 0; w < BBWORDS; w++) {
+    gs->bb_cross[w] = lk->item[l][w] & gs->bb_cross0[w];
+    gs->bb_pellet[w] = lk->item[l][w] & gs->bb_pellet0[w];
+  }
+
+  for (e = 0; e < NENTITY; e++) {
+    ep = &gs->ent[e];
+    ep->resurr = lk->resurr[e][l];
+    ep->reward = lk->reward[e][l];
+    ep->vrown = lk->vrown[e][l];
+    ep->pcoln = lk->pcoln[e][l];
+    ep->glyph = lk->glyph[e][l];
+    ep->cdir = lk->cdir[e][l];
+    ep->pdir = lk->pdir[e][l];
+    ep->idir = lk->idir[e][l];
+    ep->revflg = lk->revflg[e][l];
+    ep->inited = lk->inited[e][l];
+    ep->gobbling = lk->gobbling[e][l];
+  }
+}
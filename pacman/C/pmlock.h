@@ -0,0 +1,85 @@
+#ifndef PMLOCK_H
+#define PMLOCK_H
+
+#include <stdint.h>
+
+#include "pmcore.h"
+
+// Lockstep engine. K games (lanes) are stepped together, in
+// struct-of-arrays form: one array per entity field and entity
+// slot, one array per game variable, indexed by lane. Each phase
+// of entity_move() runs over all lanes before the next one, as a
+// loop the compiler can vectorize. Direction choices, only made on
+// even coordinates, run on packed lane indices, as selects rather
+// than branches. What only some lanes do (eat, die, enter a new
+// level) is handled lane by lane, under a mask.
+//
+// The rules are those of pmcore.c and a lane evolves exactly as
+// the same game would through game_step().
+//
+// The maze walls never change: eating only turns an item into a
+// blank. So the grid of a game boils down to a bit plane of the
+// items still on the board, the rest (the maze planes and exit
+// masks of a game_t) being shared by all lanes.
+
+#define LOCK_MAXLANE 4096
+
+typedef struct lock_t {
+  // Shared by all lanes: a game that just entered level #1, for
+  // its maze and ghost AI, and what never changes.
+  game_t gs0;
+  uint8_t vrow0[NENTITY];
+  uint8_t pcol0[NENTITY];
+  uint8_t dir0[NENTITY];
+  uint8_t hcvrn[NENTITY];
+  uint8_t hcpcn[NENTITY];
+
+  uint32_t nlane;                // May be lowered as games run out
+  uint8_t live[LOCK_MAXLANE];    // TRUE if the lane holds a game
+
+  // Game variables.
+  uint16_t seed[LOCK_MAXLANE];
+  uint32_t score[LOCK_MAXLANE];
+  uint32_t lives[LOCK_MAXLANE];
+  uint32_t gamlev[LOCK_MAXLANE];
+  uint32_t suptim[LOCK_MAXLANE];
+  uint32_t gm_cur[LOCK_MAXLANE];
+  uint32_t gm_prv[LOCK_MAXLANE];
+  int32_t gm_timer_en[LOCK_MAXLANE];
+  uint32_t gm_seqno[LOCK_MAXLANE];
+  uint32_t gm_timer[LOCK_MAXLANE];
+  uint32_t fright_timer[LOCK_MAXLANE];
+  uint32_t over[LOCK_MAXLANE];
+  uint32_t tick[LOCK_MAXLANE];
+
+  // Entity fields, per slot. The others (initial position and
+  // direction, home corner, instance number) are the same in
+  // every game.
+  uint8_t resurr[NENTITY][LOCK_MAXLANE];
+  uint8_t reward[NENTITY][LOCK_MAXLANE];
+  uint8_t vrown[NENTITY][LOCK_MAXLANE];
+  uint8_t pcoln[NENTITY][LOCK_MAXLANE];
+  uint8_t glyph[NENTITY][LOCK_MAXLANE];
+  uint8_t cdir[NENTITY][LOCK_MAXLANE];
+  uint8_t pdir[NENTITY][LOCK_MAXLANE];
+  uint8_t idir[NENTITY][LOCK_MAXLANE];
+  uint8_t revflg[NENTITY][LOCK_MAXLANE];
+  uint8_t inited[NENTITY][LOCK_MAXLANE];
+  uint8_t gobbling[NENTITY][LOCK_MAXLANE];
+
+  // Scratch: the lanes where the entity being moved moves.
+  uint8_t move[LOCK_MAXLANE];
+
+  // Items still on the board, crosses and pellets in one plane.
+  // gs0.bb_pellet0 tells them apart.
+  uint32_t item[LOCK_MAXLANE][BBWORDS];
+} lock_t;
+
+lock_t *lock_new(uint32_t nlane, ghostai_t ai, const mazedist_t *md);
+void lock_free(lock_t *lk);
+void lock_start(lock_t *lk, uint32_t lane);
+void lock_move(lock_t *lk, uint32_t dst, uint32_t src);
+void lock_step(lock_t *lk, const uint8_t *input);
+void lock_export(lock_t *lk, uint32_t lane, game_t *gs);
+
+#endif                                   // PMLOCK_H
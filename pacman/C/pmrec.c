@@ -0,0 +1,402 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __VMS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "pmrec.h"
+
+// Input log recording and playback. See pmrec.h for the format.
+
+// ------------------------------------------------------------
+// Common.
+
+// Fingerprint of the game rules: the state right after the first
+// level entry. A log recorded against other rules (maze, entities,
+// PRNG reseed value, ghost AI) would not replay. No ghost moves on
+// that step, so no distance table is needed.
+uint32_t
+rec_rules(ghostai_t ai) {
+  uint32_t digest;
+  game_t gs;
+
+  game_init(&gs);
+  game_set_ghostai(&gs, ai, NULL);
+  (void)game_step(&gs, dir_unspec);
+  digest = game_digest(&gs);
+  game_free(&gs);
+  return digest;
+}
+
+const char *
+rec_variant_name(uint8_t variant) {
+  switch (variant) {
+    case rec_headless:
+      return "headless";
+    case rec_vt420:
+      return "VT420";
+    case rec_vt340:
+      return "VT340";
+  }
+  return "unknown";
+}
+
+// ------------------------------------------------------------
+// Recording.
+
+void
+rec_put(rec_t *rp, const uint8_t *p, uint32_t len) {
+  if (fwrite(p, 1, len, rp->fp) != len)
+    crash_and_burn("rec_put: write error");
+  rp->off += len;
+}
+
+void
+rec_varint(rec_t *rp, uint32_t val) {
+  uint8_t buf[5];
+  uint32_t n = 0;
+
+  while (val >= 0x80) {
+    buf[n++] = val | 0x80;
+    val >>= 7;
+  }
+  buf[n++] = val;
+  rec_put(rp, buf, n);
+}
+
+// A keyframe is written every 'interval' steps, none if 0. The games
+// recorded use ghost AI 'ai'.
+rec_t *
+rec_create(char *path, uint8_t variant, char *build, uint32_t interval,
+  ghostai_t ai) {
+  uint8_t hdr[REC_HDRSIZE];
+  uint32_t len = strlen(build);
+  rec_t *rp;
+
+  if (!(rp = calloc(sizeof(rec_t), 1)))
+    crash_and_burn("rec_create: calloc returned NULL");
+  if (!(rp->fp = fopen(path, "wb")))
+    crash_and_burn("rec_create: cannot create the input log");
+  rp->interval = interval;
+
+  if (len > 255)
+    len = 255;
+  memcpy(hdr, REC_MAGIC, 4);
+  hdr[4] = REC_VERSION;
+  hdr[5] = variant;
+  hdr[6] = CLKPERIOD & 0xFF;
+  hdr[7] = CLKPERIOD >> 8;
+  put_le32(hdr + 8, rec_rules(ai));
+  hdr[12] = len;
+  rec_put(rp, hdr, REC_HDRSIZE);
+  rec_put(rp, (const uint8_t *)build, len);
+  return rp;
+}
+
+// Key 'dir' goes to game_step() on step 'tick'. At most one key per
+// step, in increasing step order.
+void
+rec_key(rec_t *rp, uint32_t tick, uint8_t dir) {
+  if (tick <= rp->tick || dir >= dir_blocked)
+    crash_and_burn("rec_key: out of sequence");
+
+  rec_varint(rp, (tick - rp->tick) << 2 | dir);
+  rp->tick = tick;
+}
+
+// Called after every game_step(): writes a keyframe when one is due.
+void
+rec_step(rec_t *rp, game_t *gs) {
+  uint8_t buf[SNAPSIZE];
+  snap_t snap;
+
+  if (!rp->interval || gs->tick % rp->interval)
+    return;
+
+  if (rp->nkf == rp->maxkf) {
+    rp->maxkf = rp->maxkf ? 2 * rp->maxkf : 64;
+    if (!(rp->kf = realloc(rp->kf, 2 * rp->maxkf * sizeof(uint32_t))))
+      crash_and_burn("rec_step: realloc returned NULL");
+  }
+  rec_varint(rp, 1);
+  rec_varint(rp, gs->tick);
+  rp->kf[2 * rp->nkf] = gs->tick;
+  rp->kf[2 * rp->nkf++ + 1] = rp->off;
+  game_snapshot(gs, &snap);
+  snap_put(buf, &snap);
+  rec_put(rp, buf, SNAPSIZE);
+  rp->tick = gs->tick;
+}
+
+// 'tick' steps have been run. 'gs' is the resulting state, or NULL
+// if it is not to be trusted (interrupted in the middle of a step).
+void
+rec_close(rec_t *rp, uint32_t tick, game_t *gs) {
+  uint8_t buf[REC_TRLSIZE];
+  uint32_t end = rp->off, idx, i;
+
+  rec_varint(rp, 0);
+  rec_varint(rp, tick);
+  buf[0] = gs != NULL;
+  put_le32(buf + 1, gs ? game_digest(gs) : 0);
+  rec_put(rp, buf, 5);
+
+  idx = rp->off;
+  for (i = 0; i < rp->nkf; i++) {
+    put_le32(buf, rp->kf[2 * i]);
+    put_le32(buf + 4, rp->kf[2 * i + 1]);
+    rec_put(rp, buf, 8);
+  }
+  put_le32(buf, end);
+  put_le32(buf + 4, idx);
+  put_le32(buf + 8, rp->nkf);
+  memcpy(buf + 12, REC_TMAGIC, 4);
+  rec_put(rp, buf, REC_TRLSIZE);
+
+  if (fclose(rp->fp))
+    crash_and_burn("rec_close: write error");
+  free(rp->kf);
+  free(rp);
+}
+
+// ------------------------------------------------------------
+// Playback.
+
+// Decode the varint at '*pp', not going past 'end'.
+uint32_t
+replay_varint(const uint8_t **pp, const uint8_t *end) {
+  uint32_t val = 0, shift = 0;
+  uint8_t c;
+
+  do {
+    if (*pp >= end || shift > 28)
+      crash_and_burn("replay_varint: truncated or corrupt input log");
+    c = *(*pp)++;
+    val |= (uint32_t)(c & 0x7F) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return val;
+}
+
+// Map the whole log in memory, read-only.
+const uint8_t *
+replay_map(char *path, uint32_t *lenp) {
+  uint8_t *buf = NULL;
+#ifdef __VMS
+  uint32_t len = 0, maxlen = 0, n;
+  FILE *fp;
+
+  if (!(fp = fopen(path, "rb")))
+    crash_and_burn("replay_load: cannot open the input log");
+  do {
+    if (len == maxlen) {
+      maxlen = maxlen ? 2 * maxlen : 4096;
+      if (!(buf = realloc(buf, maxlen)))
+        crash_and_burn("replay_load: realloc returned NULL");
+    }
+    len += n = fread(buf + len, 1, maxlen - len, fp);
+  } while (n);
+  fclose(fp);
+  *lenp = len;
+#else
+  struct stat st;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    crash_and_burn("replay_load: cannot open the input log");
+  if (fstat(fd, &st) || st.st_size > 0x7FFFFFFF)
+    crash_and_burn("replay_load: cannot size the input log");
+  *lenp = st.st_size;
+  if (st.st_size && (buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+    fd, 0)) == MAP_FAILED)
+    crash_and_burn("replay_load: cannot map the input log");
+  close(fd);
+#endif
+  return buf;
+}
+
+// The end record at 'p', past its tag.
+void
+replay_end(replay_t *rp, const uint8_t *p) {
+  const uint8_t *end = rp->map + rp->len;
+
+  rp->ended = 1;
+  rp->end_tick = replay_varint(&p, end);
+  if (end - p < 5)
+    crash_and_burn("replay_load: truncated end record");
+  rp->end_hasdigest = p[0] & 1;
+  rp->end_digest = get_le32(p + 1);
+}
+
+// No trailer: walk the records, for the keyframes and the end record.
+void
+replay_scan(replay_t *rp) {
+  const uint8_t *p = rp->map + rp->body, *end = rp->map + rp->len;
+  uint32_t val, maxidx = 0;
+
+  while (p < end) {
+    if (!(val = replay_varint(&p, end))) {
+      replay_end(rp, p);
+      break;
+    }
+    if (val == 1) {
+      val = replay_varint(&p, end);
+      if (end - p < SNAPSIZE)
+        break;                   // Cut short while writing it
+      if (rp->nidx == maxidx) {
+        maxidx = maxidx ? 2 * maxidx : 64;
+        if (!(rp->idxbuf = realloc(rp->idxbuf, 8 * maxidx)))
+          crash_and_burn("replay_load: realloc returned NULL");
+      }
+      put_le32(rp->idxbuf + 8 * rp->nidx, val);
+      put_le32(rp->idxbuf + 8 * rp->nidx++ + 4, p - rp->map);
+      p += SNAPSIZE;
+    } else if (val < 4)
+      crash_and_burn("replay_load: unknown record");
+  }
+  rp->idx = rp->idxbuf;
+}
+
+// The games replayed use ghost AI 'ai', that of the recording.
+void
+replay_load(char *path, replay_t *rp, ghostai_t ai) {
+  const uint8_t *p, *t;
+  uint32_t endoff, idxoff, nidx;
+
+  memset(rp, 0, sizeof(*rp));
+  p = rp->map = replay_map(path, &rp->len);
+  if (rp->len < REC_HDRSIZE || memcmp(p, REC_MAGIC, 4))
+    crash_and_burn("replay_load: not an input log");
+  rp->version = p[4];
+  if (rp->version != REC_VERSION)
+    crash_and_burn("replay_load: unsupported format version");
+  if ((uint32_t)(p[6] | p[7] << 8) != CLKPERIOD)
+    crash_and_burn("replay_load: recorded with another clock period");
+  if (get_le32(p + 8) != rec_rules(ai))
+    crash_and_burn("replay_load: recorded with other game rules");
+  rp->variant = p[5];
+  if (rp->len < REC_HDRSIZE + (uint32_t)p[12])
+    crash_and_burn("replay_load: truncated input log");
+  memcpy(rp->build, p + REC_HDRSIZE, p[12]);
+  rp->body = REC_HDRSIZE + p[12];
+
+  // Complete logs end with a trailer locating the index.
+  t = p + rp->len - REC_TRLSIZE;
+  if (rp->len >= rp->body + REC_TRLSIZE && !memcmp(t + 12, REC_TMAGIC, 4)) {
+    endoff = get_le32(t);
+    idxoff = get_le32(t + 4);
+    nidx = get_le32(t + 8);
+    if (endoff < rp->body || endoff >= idxoff ||
+      idxoff + 8 * nidx != rp->len - REC_TRLSIZE || p[endoff])
+      crash_and_burn("replay_load: corrupt keyframe index");
+    replay_end(rp, p + endoff + 1);
+    rp->idx = p + idxoff;
+    rp->nidx = nidx;
+  } else
+    replay_scan(rp);
+}
+
+void
+replay_free(replay_t *rp) {
+#ifdef __VMS
+  free((void *)rp->map);
+#else
+  if (rp->map)
+    munmap((void *)rp->map, rp->len);
+#endif
+  free(rp->idxbuf);
+  memset(rp, 0, sizeof(*rp));
+}
+
+// Decode records up to the next key, skipping keyframes.
+void
+replay_fetch(replay_t *rp, recpos_t *cp) {
+  const uint8_t *p = rp->map + cp->off, *end = rp->map + rp->len;
+  uint32_t val;
+
+  cp->key.tick = 0;
+  while (p < end) {
+    if (!(val = replay_varint(&p, end)))
+      break;
+    if (val == 1) {
+      cp->tick = replay_varint(&p, end);
+      if (end - p < SNAPSIZE)
+        break;
+      p += SNAPSIZE;
+    } else if (val < 4)
+      crash_and_burn("replay_fetch: unknown record");
+    else {
+      cp->tick += val >> 2;
+      cp->key.tick = cp->tick;
+      cp->key.dir = val & 3;
+      break;
+    }
+  }
+  cp->off = p - rp->map;
+}
+
+// Position 'cp' on the first step.
+void
+replay_rewind(replay_t *rp, recpos_t *cp) {
+  cp->off = rp->body;
+  cp->tick = 0;
+  replay_fetch(rp, cp);
+}
+
+// The input for step 'tick'. Steps must be asked for in order.
+uint8_t
+replay_input(replay_t *rp, recpos_t *cp, uint32_t tick) {
+  uint8_t dir = dir_unspec;
+
+  while (cp->key.tick && cp->key.tick <= tick) {
+    dir = cp->key.dir;
+    replay_fetch(rp, cp);
+  }
+  return dir;
+}
+
+// Bring 'gs', fresh from game_init() and game_set_ghostai(), to step
+// 'tick' or to the end of the game if that comes first: restore the
+// last keyframe at or before 'tick' and run the steps from there.
+// 'cp' is left on the next step. Returns the number of steps run.
+uint32_t
+replay_seek(replay_t *rp, uint32_t tick, game_t *gs, recpos_t *cp) {
+  uint32_t lo = 0, hi = rp->nidx, mid, nstep = 0;
+  const uint8_t *kf;
+  snap_t snap;
+
+  while (lo < hi) {              // First keyframe past 'tick'
+    mid = (lo + hi) / 2;
+    if (get_le32(rp->idx + 8 * mid) <= tick)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo) {
+    kf = rp->idx + 8 * (lo - 1);
+    cp->tick = get_le32(kf);
+    cp->off = get_le32(kf + 4);
+    if (cp->off < rp->body || cp->off > rp->len - SNAPSIZE)
+      crash_and_burn("replay_seek: corrupt keyframe index");
+    snap_get(rp->map + cp->off, &snap);
+    game_restore(gs, &snap);
+    if (gs->tick != cp->tick)
+      crash_and_burn("replay_seek: keyframe out of place");
+    cp->off += SNAPSIZE;
+    replay_fetch(rp, cp);
+  } else
+    replay_rewind(rp, cp);
+
+  while (gs->tick < tick && !gs->over) {
+    (void)game_step(gs, replay_input(rp, cp, gs->tick + 1));
+    nstep++;
+  }
+  return nstep;
+}
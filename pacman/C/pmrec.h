@@ -0,0 +1,116 @@
+#ifndef PMREC_H
+#define PMREC_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pmcore.h"
+
+// Input logs. The PRNG is reseeded at every level entry, so a game
+// only depends on which arrow keys reached game_step() and when.
+// A log of those replays the game exactly, on a terminal (pm420 -p,
+// pm340 -p) or headless (pmsim -p). Keyframes, full copies of the
+// game state taken every so many steps, let a player seek to any
+// step without re-running the game from the start.
+//
+// File layout. Multi-byte integers are little endian.
+//
+//   0   4  magic, "PMRP"
+//   4   1  format version (REC_VERSION)
+//   5   1  variant: recvariant_t
+//   6   2  clock period, milliseconds
+//   8   4  rules fingerprint: game_digest() after the first level entry
+//   12  1  length of the build string, then the build string itself
+//
+// Then one varint per key: (tick - previous tick) << 2 | direction.
+// Varints are LEB128: 7 bits per byte, least significant first, bit
+// 7 set on all bytes but the last. Ticks are step numbers, as in
+// game_t.tick, so the difference is never zero and a varint below 4
+// can serve as a record tag:
+//
+//   0  end of log: varint tick, 1 byte flags (bit 0: digest valid),
+//      4 bytes game_digest() after that many steps.
+//   1  keyframe: varint tick, then the state after that many steps,
+//      serialized by snap_put(), SNAPSIZE bytes. The next key's
+//      tick is relative to it.
+//
+// After the end record comes the keyframe index, one 8 byte entry
+// per keyframe (tick, file offset of the state), by increasing
+// tick, and a 16 byte trailer: offset of the end record, offset of
+// the index, number of entries, "PMRX".
+//
+// A log cut short (process killed) has no end record and no index.
+// It still plays: the keyframes are then found by scanning it.
+
+#define REC_MAGIC "PMRP"
+#define REC_TMAGIC "PMRX"
+#define REC_VERSION 1
+#define REC_HDRSIZE 13            // Up to the build string
+#define REC_TRLSIZE 16
+
+typedef enum recvariant_t {
+  rec_headless,
+  rec_vt420,
+  rec_vt340
+} recvariant_t;
+
+// A key press: PM's intended direction, handed to game_step() on
+// step 'tick'.
+typedef struct keypress {
+  uint32_t tick;
+  uint8_t dir;
+} keypress;
+
+// Recording.
+typedef struct rec_t {
+  FILE *fp;
+  uint32_t off;                  // Bytes written so far
+  uint32_t tick;                 // Delta base for the next key
+  uint32_t interval;             // Steps between keyframes, 0 if none
+  uint32_t nkf;                  // Keyframe index
+  uint32_t maxkf;
+  uint32_t *kf;                  // Pairs of tick, offset
+} rec_t;
+
+// Playback. The log is mapped in memory; keyframes are restored
+// straight from there.
+typedef struct replay_t {
+  uint8_t version;
+  uint8_t variant;
+  char build[256];
+  const uint8_t *map;
+  uint32_t len;
+  uint32_t body;                 // Offset of the first record
+  const uint8_t *idx;            // Keyframe index, 8 bytes per entry
+  uint32_t nidx;
+  uint8_t *idxbuf;               // Index built by scanning, if any
+  uint32_t ended;                // TRUE if there is an end record
+  uint32_t end_tick;
+  uint32_t end_hasdigest;
+  uint32_t end_digest;
+} replay_t;
+
+// A read position in a replay.
+typedef struct recpos_t {
+  uint32_t off;                  // Next record
+  uint32_t tick;                 // Delta base
+  keypress key;                  // Pending key, tick 0 if none left
+} recpos_t;
+
+uint32_t rec_rules(ghostai_t ai);
+const char *rec_variant_name(uint8_t variant);
+
+rec_t *rec_create(char *path, uint8_t variant, char *build,
+  uint32_t interval, ghostai_t ai);
+void rec_key(rec_t *rp, uint32_t tick, uint8_t dir);
+void rec_step(rec_t *rp, game_t *gs);
+void rec_close(rec_t *rp, uint32_t tick, game_t *gs);
+
+void replay_load(char *path, replay_t *rp, ghostai_t ai);
+void replay_free(replay_t *rp);
+void replay_rewind(replay_t *rp, recpos_t *cp);
+uint8_t replay_input(replay_t *rp, recpos_t *cp, uint32_t tick);
+uint32_t replay_seek(replay_t *rp, uint32_t tick, game_t *gs,
+  recpos_t *cp);
+
+#endif                                   // PMREC_H
@@ -0,0 +1,888 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef SIM_THREAD       // Multi-threaded batches (-j)
+#include <pthread.h>
+#endif
+
+#include "pmcore.h"
+#include "pmlock.h"
+#include "pmrec.h"
+
+// Headless Pacman. The game rules of pm420/pm340 (pmcore.c) with
+// a null renderer: no terminal, no clock. Games are run back to
+// back, as fast as the CPU allows, each one until it is over or
+// 'maxticks' steps have been run.
+//
+// Input comes from a script, one "<step> <u|l|d|r>" line per key
+// press, from an input log recorded by pm420/pm340 (-p), or from a
+// PRNG seeded per game. Either way the direction is handed to
+// game_step() on that step, as if the arrow key had been pressed
+// during the previous clock cycle of the interactive game. With
+// -g, games replaying a log start at some step of it, restored
+// from the nearest keyframe.
+//
+// Games are independent: each one has its own game_t and input_t
+// and its result only depends on its seed. With -j, they are
+// shared among worker threads and the output does not depend on
+// the number of threads.
+//
+// With -k, every worker steps its games 'nlane' at a time through
+// the lockstep engine (pmlock.c) rather than one by one through
+// game_step(). Results are the same, -b checks that they are.
+
+#define DEF_MAXTICKS 100000
+
+void
+crash_and_burn(char *errmsg) {
+  fprintf(stderr, "%s\n", errmsg);
+  exit(1);
+}
+
+// -------------------------------------------------------------
+// Input. A script is loaded once and shared by all games.
+
+uint32_t script_on = 0;          // TRUE if input is scripted
+keypress *script = NULL;
+uint32_t script_len = 0;
+
+void
+script_load(char *path) {
+  uint32_t maxlen = 0;
+  unsigned tick;
+  FILE *fp;
+  char c;
+
+  if (!(fp = fopen(path, "r"))) {
+    perror(path);
+    exit(1);
+  }
+  script_on = 1;
+
+  while (fscanf(fp, "%u %c", &tick, &c) == 2) {
+    if (script_len == maxlen) {
+      maxlen = maxlen ? 2 * maxlen : 256;
+      if (!(script = realloc(script, maxlen * sizeof(keypress))))
+        crash_and_burn("script_load: realloc returned NULL");
+    }
+
+    script[script_len].tick = tick;
+    switch (c) {
+      case 'u':
+        script[script_len].dir = dir_up;
+        break;
+      case 'l':
+        script[script_len].dir = dir_left;
+        break;
+      case 'd':
+        script[script_len].dir = dir_down;
+        break;
+      case 'r':
+        script[script_len].dir = dir_right;
+        break;
+      default:
+        crash_and_burn("script_load: unknown direction");
+    }
+    script_len++;
+  }
+  fclose(fp);
+}
+
+// -e: the ghost AI of every game. The distance table (ai_maze only)
+// is built once, before the workers start, and only read by them.
+ghostai_t batch_ai = ai_euclid;
+mazedist_t batch_md;
+
+// -p: an input log recorded by pm420/pm340 stands for the script.
+// The games stop where the recording did.
+replay_t replay;
+uint32_t replay_on = 0;
+uint32_t replay_from = 0;        // -g: first step, through keyframes
+
+void
+replay_use(char *path, ghostai_t ai) {
+  replay_load(path, &replay, ai);
+  replay_on = 1;
+}
+
+// Per game input state.
+typedef struct input_t {
+  uint32_t next;                 // Script: index of the next key
+  recpos_t pos;                  // Replay: read position
+  uint32_t rng;                  // Random: xorshift32 state
+  uint32_t wait;                 // Random: # steps till the next key
+} input_t;
+
+void
+input_init(input_t *in, uint32_t seed) {
+  in->next = 0;
+  in->rng = seed * 2654435761u | 1;   // Never zero
+  in->wait = 1;
+  if (replay_on)
+    replay_rewind(&replay, &in->pos);
+}
+
+uint32_t
+input_random(input_t *in) {
+  in->rng ^= in->rng << 13;
+  in->rng ^= in->rng >> 17;
+  in->rng ^= in->rng << 5;
+  return in->rng;
+}
+
+// PM's intended direction for step 'tick', or dir_unspec.
+uint8_t
+input_get(input_t *in, uint32_t tick) {
+  uint8_t dir = dir_unspec;
+  uint32_t r;
+
+  if (replay_on)
+    return replay_input(&replay, &in->pos, tick);
+  if (script_on) {
+    // Several keys for the same step: only the last one counts.
+    while (in->next < script_len && script[in->next].tick <= tick)
+      dir = script[in->next++].dir;
+    return dir;
+  }
+
+  // A random arrow key every 1 to 16 steps.
+  if (--in->wait)
+    return dir_unspec;
+  r = input_random(in);
+  in->wait = 1 + ((r >> 8) & 15);
+  return r & 3;
+}
+
+// -------------------------------------------------------------
+// Batch execution.
+
+typedef enum format_t {
+  fmt_text,
+  fmt_csv,
+  fmt_json
+} format_t;
+
+typedef struct result_t {
+  uint32_t seed;
+  uint32_t steps;
+  uint32_t score;
+  uint32_t lives;
+  uint32_t level;
+  uint32_t over;
+  uint32_t digest;
+} result_t;
+
+void
+result_set(result_t *rp, uint32_t seed, game_t *gs) {
+  rp->seed = seed;
+  rp->steps = gs->tick;
+  rp->score = gs->score;
+  rp->lives = gs->lives;
+  rp->level = gs->gamlev;
+  rp->over = gs->over;
+  rp->digest = game_digest(gs);
+}
+
+void
+game_run(uint32_t seed, uint32_t maxticks, result_t *rp) {
+  game_t game;
+  input_t in;
+
+  input_init(&in, seed);
+  game_init(&game);
+  game_set_ghostai(&game, batch_ai, &batch_md);
+  if (replay_from)
+    (void)replay_seek(&replay, replay_from, &game, &in.pos);
+  while (!game.over && game.tick < maxticks)
+    (void)game_step(&game, input_get(&in, game.tick + 1));
+
+  result_set(rp, seed, &game);
+  game_free(&game);
+}
+
+// -------------------------------------------------------------
+// Worker pool (-j). Every worker owns a range of game numbers. It
+// runs them from the bottom and, once its range is exhausted,
+// steals the top half of some other worker's range. Results go to
+// their own slot in res[], so nothing needs merging but the
+// per-worker counters, which are added up at the end.
+
+#define MAXWORKER 256
+
+typedef struct worker_t {
+#ifdef SIM_THREAD
+  pthread_t tid;
+  pthread_mutex_t lock;          // Protects lo and hi
+#endif
+  uint32_t lo, hi;               // Games [lo, hi) are still to be run
+  uint32_t ngame;                // # games run by this worker
+  uint32_t nsteal;               // # successful steals
+  char pad[64];                  // Keep workers off each other's lines
+} worker_t;
+
+worker_t worker[MAXWORKER];
+uint32_t nworker = 1;
+
+// Batch parameters, read-only once the workers have started.
+result_t *res;
+uint32_t batch_seed;
+uint32_t batch_maxticks;
+uint32_t batch_nlane = 0;        // Lockstep lanes per worker, 0 if off
+
+// Returns the next game number for 'wp', or -1 if none left.
+int64_t
+worker_take(worker_t *wp) {
+  int64_t i = -1;
+
+#ifdef SIM_THREAD
+  pthread_mutex_lock(&wp->lock);
+#endif
+  if (wp->lo < wp->hi)
+    i = wp->lo++;
+#ifdef SIM_THREAD
+  pthread_mutex_unlock(&wp->lock);
+#endif
+  return i;
+}
+
+#ifdef SIM_THREAD
+// Move the top half of some other worker's range over to 'wp'.
+// Returns 0 if there was nothing left to steal.
+uint32_t
+worker_steal(worker_t *wp) {
+  uint32_t i, n, lo = 0, hi = 0;
+  worker_t *vp;
+
+  for (i = 1; i < nworker; i++) {
+    vp = &worker[(wp - worker + i) % nworker];
+    pthread_mutex_lock(&vp->lock);
+    if ((n = vp->hi - vp->lo) > 0) {
+      hi = vp->hi;
+      lo = vp->hi -= (n + 1) / 2;
+    }
+    pthread_mutex_unlock(&vp->lock);
+    if (lo < hi)
+      break;
+  }
+  if (lo == hi)
+    return 0;
+
+  pthread_mutex_lock(&wp->lock);
+  wp->lo = lo;
+  wp->hi = hi;
+  pthread_mutex_unlock(&wp->lock);
+  wp->nsteal++;
+  return 1;
+}
+#endif
+
+// Returns the next game number for 'wp', stealing if need be, or
+// -1 once all games have been handed out.
+int64_t
+worker_next(worker_t *wp) {
+  int64_t i;
+
+  while ((i = worker_take(wp)) == -1)
+#ifdef SIM_THREAD
+    if (!worker_steal(wp))
+#endif
+      break;
+  return i;
+}
+
+// Lockstep flavour of worker_main(). A lane is refilled with the
+// next game as soon as its game is over or interrupted, so that
+// short and long games mix freely. Once there are no games left,
+// the top lane fills the hole instead, so that the batch's tail
+// does not drag empty lanes along.
+void
+worker_lock(worker_t *wp) {
+  uint8_t input[LOCK_MAXLANE];
+  int64_t gnum[LOCK_MAXLANE];
+  input_t in[LOCK_MAXLANE];
+  uint32_t l, top;
+  lock_t *lk;
+  game_t game;
+  int64_t i;
+
+  lk = lock_new(batch_nlane, batch_ai, &batch_md);
+  game_init(&game);                      // Scratch copy for results
+
+  for (;;) {
+    for (l = 0; l < lk->nlane; ) {
+      if (!lk->live[l]) {
+        if ((i = worker_next(wp)) != -1) {
+          gnum[l] = i;
+          input_init(&in[l], batch_seed + i);
+          lock_start(lk, l);
+        }
+        else {
+          top = --lk->nlane;
+          if (l < top) {
+            lock_move(lk, l, top);
+            gnum[l] = gnum[top];
+            in[l] = in[top];
+          }
+          continue;
+        }
+      }
+      input[l] = input_get(&in[l], lk->tick[l] + 1);
+      l++;
+    }
+    if (!lk->nlane)
+      break;
+
+    lock_step(lk, input);
+
+    for (l = 0; l < lk->nlane; l++)
+      if (lk->over[l] || lk->tick[l] >= batch_maxticks) {
+        lock_export(lk, l, &game);
+        result_set(&res[gnum[l]], batch_seed + gnum[l], &game);
+        lk->live[l] = 0;
+        wp->ngame++;
+      }
+  }
+
+  game_free(&game);
+  lock_free(lk);
+}
+
+void *
+worker_main(void *arg) {
+  worker_t *wp = (worker_t *)arg;
+  int64_t i;
+
+  if (batch_nlane) {
+    worker_lock(wp);
+    return NULL;
+  }
+
+  while ((i = worker_next(wp)) != -1) {
+    game_run(batch_seed + i, batch_maxticks, &res[i]);
+    wp->ngame++;
+  }
+  return NULL;
+}
+
+// Run games [0, ngame). The initial ranges are even; stealing
+// takes care of games that last longer than others.
+void
+batch_run(uint32_t ngame) {
+  uint32_t i;
+
+  if (nworker > ngame)
+    nworker = ngame;
+  for (i = 0; i < nworker; i++) {
+    worker[i].ngame = worker[i].nsteal = 0;
+    worker[i].lo = (uint64_t)ngame * i / nworker;
+    worker[i].hi = (uint64_t)ngame * (i + 1) / nworker;
+#ifdef SIM_THREAD
+    pthread_mutex_init(&worker[i].lock, NULL);
+#endif
+  }
+
+#ifdef SIM_THREAD
+  for (i = 1; i < nworker; i++)
+    if (pthread_create(&worker[i].tid, NULL, worker_main, &worker[i]))
+      crash_and_burn("batch_run: pthread_create failed");
+#endif
+  (void)worker_main(&worker[0]);
+#ifdef SIM_THREAD
+  for (i = 1; i < nworker; i++)
+    pthread_join(worker[i].tid, NULL);
+  for (i = 0; i < nworker; i++)
+    pthread_mutex_destroy(&worker[i].lock);
+#endif
+}
+
+void
+result_print(format_t fmt, uint32_t i, result_t *rp) {
+  char *outcome = rp->over ? "game over" : "interrupted";
+
+  switch (fmt) {
+    case fmt_text:
+      printf("game %u: seed %u, %u steps, score %u, %u lives, level %u, "
+        "%s, digest %08x\n", (unsigned)i, (unsigned)rp->seed,
+        (unsigned)rp->steps, (unsigned)rp->score, (unsigned)rp->lives,
+        (unsigned)rp->level, outcome, (unsigned)rp->digest);
+      break;
+    case fmt_csv:
+      printf("%u,%u,%u,%u,%u,%u,%s,%08x\n", (unsigned)i, (unsigned)rp->seed,
+        (unsigned)rp->steps, (unsigned)rp->score, (unsigned)rp->lives,
+        (unsigned)rp->level, outcome, (unsigned)rp->digest);
+      break;
+    case fmt_json:
+      printf("%s    {\"game\": %u, \"seed\": %u, \"steps\": %u, "
+        "\"score\": %u, \"lives\": %u, \"level\": %u, \"outcome\": \"%s\", "
+        "\"digest\": \"%08x\"}", i ? ",\n" : "", (unsigned)i,
+        (unsigned)rp->seed, (unsigned)rp->steps, (unsigned)rp->score,
+        (unsigned)rp->lives, (unsigned)rp->level, outcome,
+        (unsigned)rp->digest);
+      break;
+  }
+}
+
+int
+score_cmp(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+// Aggregate figures. Percentiles are nearest rank.
+void
+summary_print(format_t fmt, result_t *res, uint32_t ngame, double elapsed) {
+  uint32_t *score, i, nover = 0, nsteal = 0;
+  uint64_t steps = 0, total = 0;
+  double tps, gps;
+
+  if (!(score = malloc(ngame * sizeof(uint32_t))))
+    crash_and_burn("summary_print: malloc returned NULL");
+  for (i = 0; i < ngame; i++) {
+    steps += res[i].steps;
+    total += res[i].score;
+    nover += res[i].over;
+    score[i] = res[i].score;
+  }
+  qsort(score, ngame, sizeof(uint32_t), score_cmp);
+  for (i = 0; i < nworker; i++)
+    nsteal += worker[i].nsteal;
+
+  if (elapsed <= 0)
+    elapsed = 1e-9;
+  tps = steps / elapsed;
+  gps = ngame / elapsed;
+
+#define PCTL(p) score[(uint64_t)(ngame - 1) * (p) / 100]
+  if (fmt == fmt_json)
+    printf("  \"summary\": {\"games\": %u, \"over\": %u, \"steps\": %llu, "
+      "\"seconds\": %.6f, \"ticks_per_second\": %.0f, "
+      "\"games_per_second\": %.1f, \"threads\": %u, "
+      "\"score\": {\"min\": %u, \"p10\": %u, \"p50\": %u, \"p90\": %u, "
+      "\"max\": %u, \"mean\": %.1f}}\n",
+      (unsigned)ngame, (unsigned)nover, (unsigned long long)steps, elapsed,
+      tps, gps, (unsigned)nworker, (unsigned)score[0], (unsigned)PCTL(10),
+      (unsigned)PCTL(50), (unsigned)PCTL(90), (unsigned)score[ngame - 1],
+      (double)total / ngame);
+  else {
+    fprintf(stderr, "games:    %u (%u over)\n", (unsigned)ngame,
+      (unsigned)nover);
+    fprintf(stderr, "steps:    %llu in %.3f s\n", (unsigned long long)steps,
+      elapsed);
+    fprintf(stderr, "rate:     %.0f ticks/s, %.1f games/s\n", tps, gps);
+    fprintf(stderr, "threads:  %u (%u steals)\n", (unsigned)nworker,
+      (unsigned)nsteal);
+    fprintf(stderr, "score:    min %u, p10 %u, p50 %u, p90 %u, max %u, "
+      "mean %.1f\n", (unsigned)score[0], (unsigned)PCTL(10),
+      (unsigned)PCTL(50), (unsigned)PCTL(90), (unsigned)score[ngame - 1],
+      (double)total / ngame);
+  }
+#undef PCTL
+  free(score);
+}
+
+// Did every game end up where the recorded one did?
+void
+replay_verify(result_t *res, uint32_t ngame) {
+  uint32_t i, nstep;
+  recpos_t pos;
+  game_t game;
+
+  if (replay_from) {
+    game_init(&game);
+    game_set_ghostai(&game, batch_ai, &batch_md);
+    nstep = replay_seek(&replay, replay_from, &game, &pos);
+    fprintf(stderr, "seek:     step %u from the keyframe at step %u, "
+      "%u steps run\n", (unsigned)game.tick,
+      (unsigned)(game.tick - nstep), (unsigned)nstep);
+    game_free(&game);
+  }
+
+  fprintf(stderr, "replay:   %s (%s), %u keyframes, ",
+    rec_variant_name(replay.variant), replay.build, (unsigned)replay.nidx);
+  if (!replay.ended) {
+    fprintf(stderr, "no end record\n");
+    return;
+  }
+  if (batch_maxticks < replay.end_tick) {
+    fprintf(stderr, "%u steps, stopped at step %u\n",
+      (unsigned)replay.end_tick, (unsigned)batch_maxticks);
+    return;
+  }
+  if (!replay.end_hasdigest) {
+    fprintf(stderr, "%u steps, no final digest\n",
+      (unsigned)replay.end_tick);
+    return;
+  }
+
+  for (i = 0; i < ngame; i++)
+    if (res[i].steps != replay.end_tick ||
+      res[i].digest != replay.end_digest) {
+      fprintf(stderr, "%u steps, game %u differs (digest %08x vs %08x)\n",
+        (unsigned)replay.end_tick, (unsigned)i, (unsigned)res[i].digest,
+        (unsigned)replay.end_digest);
+      exit(1);
+    }
+  fprintf(stderr, "%u steps, same final state (digest %08x)\n",
+    (unsigned)replay.end_tick, (unsigned)replay.end_digest);
+}
+
+double
+now(void) {
+  struct timespec ts;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// -b: run the batch through game_step() then through the lockstep
+// engine. The results must match game for game. Returns the
+// lockstep run's elapsed time.
+double
+bench_run(uint32_t ngame) {
+  double t0, tscalar, tlock;
+  uint64_t steps = 0;
+  uint32_t i, nlane = batch_nlane ? batch_nlane : 256;
+  result_t *ref;
+
+  batch_nlane = 0;
+  t0 = now();
+  batch_run(ngame);
+  tscalar = now() - t0;
+  ref = res;
+  if (!(res = malloc(ngame * sizeof(result_t))))
+    crash_and_burn("bench_run: malloc returned NULL");
+
+  batch_nlane = nlane;
+  t0 = now();
+  batch_run(ngame);
+  tlock = now() - t0;
+
+  for (i = 0; i < ngame; i++) {
+    if (memcmp(&ref[i], &res[i], sizeof(result_t))) {
+      fprintf(stderr, "bench_run: game %u differs (digest %08x vs %08x)\n",
+        (unsigned)i, (unsigned)ref[i].digest, (unsigned)res[i].digest);
+      exit(1);
+    }
+    steps += ref[i].steps;
+  }
+  free(ref);
+
+  if (tscalar <= 0)
+    tscalar = 1e-9;
+  if (tlock <= 0)
+    tlock = 1e-9;
+  fprintf(stderr, "scalar:   %.0f ticks/s\n", steps / tscalar);
+  fprintf(stderr, "lockstep: %.0f ticks/s, %u lanes, x%.2f, same results\n",
+    steps / tlock, (unsigned)batch_nlane, tscalar / tlock);
+  return tlock;
+}
+
+// -m: what a save state costs. A game is played for a while with
+// random input, then its state is saved and restored over and over.
+// Rollback is checked on the way: the same steps replayed from a
+// restored snapshot must end up in the same state.
+#define SNAP_NPASS 1000000
+#define SNAP_NSTEP 100
+
+void
+snap_bench(void) {
+  static snap_t snap, ref, copy;
+  static uint8_t buf[SNAPSIZE];
+  double t0, t_save, t_rest, t_copy, t_cmp, t_ser;
+  uint32_t pass, i, nstep, ndiff = 0;
+  input_t in, in0;
+  game_t game;
+
+  input_init(&in, 1);
+  game_init(&game);
+  for (i = 0; i < 200 && !game.over; i++)
+    (void)game_step(&game, input_get(&in, game.tick + 1));
+
+  // Rollback: step, restore, step again.
+  game_snapshot(&game, &snap);
+  in0 = in;
+  for (i = 0; i < SNAP_NSTEP && !game.over; i++)
+    (void)game_step(&game, input_get(&in, game.tick + 1));
+  nstep = i;
+  game_snapshot(&game, &ref);
+  game_restore(&game, &snap);
+  in = in0;
+  for (i = 0; i < SNAP_NSTEP && !game.over; i++)
+    (void)game_step(&game, input_get(&in, game.tick + 1));
+  game_snapshot(&game, &copy);
+  if (snap_compare(&ref, &copy))
+    crash_and_burn("snap_bench: rollback went astray");
+  snap_put(buf, &copy);
+  snap_get(buf, &ref);
+  if (snap_compare(&ref, &copy))
+    crash_and_burn("snap_bench: serialization round trip failed");
+
+  t0 = now();
+  for (pass = 0; pass < SNAP_NPASS; pass++)
+    game_snapshot(&game, &snap);
+  t_save = now() - t0;
+
+  t0 = now();
+  for (pass = 0; pass < SNAP_NPASS; pass++)
+    game_restore(&game, &snap);
+  t_rest = now() - t0;
+
+  t0 = now();
+  for (pass = 0; pass < SNAP_NPASS; pass++) {
+    copy = snap;
+    copy.tick += pass;           // Keep the copy from being elided
+  }
+  t_copy = now() - t0;
+
+  copy = snap;                   // Equal: the whole state is compared
+  t0 = now();
+  for (pass = 0; pass < SNAP_NPASS; pass++)
+    ndiff += !!snap_compare(&snap, &copy);
+  t_cmp = now() - t0;
+
+  t0 = now();
+  for (pass = 0; pass < SNAP_NPASS; pass++) {
+    snap_put(buf, &snap);
+    snap_get(buf, &copy);
+  }
+  t_ser = now() - t0;
+
+  game_free(&game);
+  printf("state:        %u bytes, step %u, %u of %u compares differ\n",
+    (unsigned)sizeof(snap_t), (unsigned)snap.tick, (unsigned)ndiff,
+    (unsigned)SNAP_NPASS);
+  printf("snapshot:     %.1f ns\n", t_save * 1e9 / SNAP_NPASS);
+  printf("restore:      %.1f ns\n", t_rest * 1e9 / SNAP_NPASS);
+  printf("copy:         %.1f ns\n", t_copy * 1e9 / SNAP_NPASS);
+  printf("compare:      %.1f ns\n", t_cmp * 1e9 / SNAP_NPASS);
+  printf("serialize:    %.1f ns (put and get)\n", t_ser * 1e9 / SNAP_NPASS);
+  printf("rollback:     %u steps replayed, same state\n", (unsigned)nstep);
+}
+
+// -m, continued: ghost direction selection, the inner loop of the
+// rules. Game states are sampled from random games and every ghost
+// standing on a tile (even coordinates) makes its decision in each
+// of them, over and over, once per ghost AI. ghost_dirselect() may
+// clear a reversal flag or draw from the PRNG, which merely
+// perturbs the sample.
+#define DIRSEL_NSTATE 1024
+#define DIRSEL_NPASS 2000
+
+void
+dirsel_bench(void) {
+  static game_t state[DIRSEL_NSTATE], work[DIRSEL_NSTATE];
+  static const char *ainame[2] = { "euclid", "maze" };
+  static mazedist_t md;
+  uint32_t n = 0, seed = 1, pass, i, e, ncall, ai;
+  double t0, t;
+  input_t in;
+  game_t game;
+  entity *ep;
+
+  t0 = now();
+  mazedist_build(&md);
+  t = now() - t0;
+  printf("mazedist:     %u tiles, %u bytes, built in %.2f ms\n",
+    (unsigned)md.ntile, (unsigned)(md.ntile * md.ntile), t * 1e3);
+
+  while (n < DIRSEL_NSTATE) {
+    input_init(&in, seed++);
+    game_init(&game);
+    game_set_ghostai(&game, batch_ai, &md);
+    while (!game.over && n < DIRSEL_NSTATE) {
+      (void)game_step(&game, input_get(&in, game.tick + 1));
+      if (!(game.tick % 7) && game.gamlev)
+        state[n++] = game;       // No pointers in a game_t
+    }
+    game_free(&game);
+  }
+
+  for (ai = ai_euclid; ai <= ai_maze; ai++) {
+    memcpy(work, state, sizeof(state));
+    for (i = 0; i < DIRSEL_NSTATE; i++)
+      game_set_ghostai(&work[i], (ghostai_t)ai, &md);
+    ncall = 0;
+    t0 = now();
+    for (pass = 0; pass < DIRSEL_NPASS; pass++)
+      for (i = 0; i < DIRSEL_NSTATE; i++)
+        for (e = 1; e < NENTITY; e++) {
+          ep = &work[i].ent[e];
+          if ((ep->vrown | ep->pcoln) & 1)
+            continue;            // Between tiles: no decision
+          (void)ghost_dirselect(&work[i], ep);
+          ncall++;
+        }
+    t = now() - t0;
+
+    printf("dirselect:    %.1f ns/call (%s), %u calls over %u states\n",
+      t * 1e9 / ncall, ainame[ai], (unsigned)ncall,
+      (unsigned)DIRSEL_NSTATE);
+  }
+  mazedist_free(&md);
+}
+
+#ifdef SIM_THREAD
+#define SIM_THREAD_OPT "j:"
+#else
+#define SIM_THREAD_OPT ""
+#endif
+
+void
+usage(char *progname) {
+  fprintf(stderr, "usage: %s [-bmq] [-e euclid|maze] [-f text|csv|json] "
+    "[-g tick]\n  [-j nthreads] [-k nlanes] [-n ngames] [-p inlog] [-s seed] "
+    "[-t maxticks] [script]\n", progname);
+  fprintf(stderr, "  -b  compare with the one game at a time engine\n");
+  fprintf(stderr, "  -e  ghost AI: straight line or maze distance (euclid)\n");
+  fprintf(stderr, "  -f  per game results format (text)\n");
+  fprintf(stderr, "  -g  with -p, start at step 'tick' of the input log\n");
+#ifdef SIM_THREAD
+  fprintf(stderr, "  -j  number of worker threads (one per CPU)\n");
+#endif
+  fprintf(stderr, "  -k  games stepped in lockstep per worker (off)\n");
+  fprintf(stderr, "  -m  run the snapshot and direction selection "
+    "microbenchmarks\n");
+  fprintf(stderr, "  -n  number of games (1)\n");
+  fprintf(stderr, "  -p  play an input log recorded by pm420/pm340\n");
+  fprintf(stderr, "  -q  aggregate figures only\n");
+  fprintf(stderr, "  -s  seed of the first game, the next ones count up (1)\n");
+  fprintf(stderr, "  -t  stop a game after 'maxticks' steps (%u)\n",
+    (unsigned)DEF_MAXTICKS);
+  fprintf(stderr, "Without a script, input is random.\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[]) {
+  uint32_t maxticks = DEF_MAXTICKS, ngame = 1, seed = 1, quiet = 0, i,
+    bench = 0, micro = 0;
+  ghostai_t ai = ai_euclid;
+  char *inlog = NULL;
+  format_t fmt = fmt_text;
+  double t0, elapsed;
+  int c;
+
+#ifdef SIM_THREAD
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+  nworker = ncpu < 1 ? 1 : (ncpu > MAXWORKER ? MAXWORKER : ncpu);
+#endif
+
+  while ((c = getopt(argc, argv, SIM_THREAD_OPT "be:f:g:k:mn:p:qs:t:")) != -1)
+    switch (c) {
+      case 'b':
+        bench = 1;
+        break;
+      case 'e':
+        if (!strcmp(optarg, "euclid"))
+          ai = ai_euclid;
+        else if (!strcmp(optarg, "maze"))
+          ai = ai_maze;
+        else
+          usage(argv[0]);
+        break;
+      case 'f':
+        if (!strcmp(optarg, "text"))
+          fmt = fmt_text;
+        else if (!strcmp(optarg, "csv"))
+          fmt = fmt_csv;
+        else if (!strcmp(optarg, "json"))
+          fmt = fmt_json;
+        else
+          usage(argv[0]);
+        break;
+      case 'g':
+        if (!(replay_from = (uint32_t)atoi(optarg)))
+          usage(argv[0]);
+        break;
+      case 'j':
+        if (!(nworker = (uint32_t)atoi(optarg)) || nworker > MAXWORKER)
+          usage(argv[0]);
+        break;
+      case 'k':
+        if (!(batch_nlane = (uint32_t)atoi(optarg)) ||
+          batch_nlane > LOCK_MAXLANE)
+          usage(argv[0]);
+        break;
+      case 'm':
+        micro = 1;
+        break;
+      case 'n':
+        if (!(ngame = (uint32_t)atoi(optarg)))
+          usage(argv[0]);
+        break;
+      case 'p':
+        inlog = optarg;
+        break;
+      case 'q':
+        quiet = 1;
+        break;
+      case 's':
+        seed = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 't':
+        if (!(maxticks = (uint32_t)atoi(optarg)))
+          usage(argv[0]);
+        break;
+      default:
+        usage(argv[0]);
+    }
+
+  batch_ai = ai;
+  if (ai == ai_maze)
+    mazedist_build(&batch_md);
+  if (micro) {
+    snap_bench();
+    dirsel_bench();
+    exit(0);
+  }
+  if (inlog)
+    replay_use(inlog, ai);
+  if (optind < argc) {
+    if (replay_on)
+      usage(argv[0]);
+    script_load(argv[optind]);
+  }
+  if (replay_from && (!replay_on || batch_nlane || bench))
+    usage(argv[0]);              // Lanes always start from step 0
+  if (replay_on && replay.ended) {
+    if (maxticks > replay.end_tick)
+      maxticks = replay.end_tick;
+    if (replay_from > maxticks)
+      replay_from = maxticks;
+  }
+  if (!(res = malloc(ngame * sizeof(result_t))))
+    crash_and_burn("main: malloc returned NULL");
+
+  batch_seed = seed;
+  batch_maxticks = maxticks;
+  if (bench)
+    elapsed = bench_run(ngame);
+  else {
+    t0 = now();
+    batch_run(ngame);
+    elapsed = now() - t0;
+  }
+
+  if (fmt == fmt_csv && !quiet)
+    printf("game,seed,steps,score,lives,level,outcome,digest\n");
+  if (fmt == fmt_json)
+    printf("{\n  \"games\": [\n");
+  for (i = 0; !quiet && i < ngame; i++)
+    result_print(fmt, i, &res[i]);
+  if (fmt == fmt_json)
+    printf("%s  ],\n", quiet ? "" : "\n");
+  summary_print(fmt, res, ngame, elapsed);
+  if (replay_on)
+    replay_verify(res, ngame);
+  if (fmt == fmt_json)
+    printf("}\n");
+
+  free(res);
+  return 0;
+}